@@ -8,9 +8,12 @@
 //namespaces 
 #pragma link C++ namespace nurfana+;
 #pragma link C++ namespace nurfana::fft+;
+#pragma link C++ class nurfana::fft::allocator<double>+; 
+#pragma link C++ class nurfana::fft::allocator<std::complex<double> >+; 
 #pragma link C++ namespace nurfana::angle+;
 #pragma link C++ namespace nurfana::ice+;
 #pragma link C++ namespace nurfana::ops+;
+#pragma link C++ namespace nurfana::raytracer+;
 
 //Interpolation stuff
 #pragma link C++ enum nurfana::InterpolationType; 
@@ -19,6 +22,8 @@
 #pragma link C++ class nurfana::GSLInterpolator+; 
 #pragma link C++ class nurfana::GridInterpolator2D+; 
 #pragma link C++ class nurfana::LinearInterpolator+; 
+#pragma link C++ class nurfana::SincInterpolator+; 
+#pragma link C++ struct nurfana::SincInterpolator::Options+; 
 
 //Waveform stuff
 #pragma link C++ class nurfana::TimeRepresentation+; 
@@ -30,11 +35,17 @@
 // Mappers
 #pragma link C++ class nurfana::Mapper+; 
 #pragma link C++ class nurfana::ElevationMapper+; 
+#pragma link C++ class nurfana::ElevationAzimuthMapper+; 
+#pragma link C++ class nurfana::IceRZMapper; 
+#pragma link C++ class nurfana::IceRZPhiMapper; 
 
 
 // correlation and combining
-#pragma link C++ class nurfana::Correlator+; 
-#pragma link C++ class nurfana::Combiner+; 
+#pragma link C++ class nurfana::Correlator; 
+#pragma link C++ struct nurfana::Correlator::Range; 
+#pragma link C++ struct nurfana::Correlator::Peak; 
+#pragma link C++ class nurfana::DelayTable; 
+#pragma link C++ class nurfana::Combiner; 
 
 
 
@@ -48,6 +59,18 @@
 #pragma link C++ class nurfana::ice::ExponentialRefractionModel+; 
 #pragma link C++ class nurfana::ice::ExponentialDensityModel+; 
 #pragma link C++ class nurfana::ice::ConstantAttenuationModel+; 
+#pragma link C++ class nurfana::ice::TabulatedProfile+; 
+#pragma link C++ class nurfana::ice::TabulatedRefractionModel+; 
+#pragma link C++ class nurfana::ice::TabulatedAttenuationModel+; 
+
+//Raytracing
+#pragma link C++ struct nurfana::raytracer::Options+; 
+#pragma link C++ class nurfana::raytracer::Turns+; 
+#pragma link C++ struct nurfana::raytracer::Solution+; 
+#pragma link C++ class nurfana::raytracer::Raytracer; 
+#pragma link C++ class nurfana::raytracer::IntegratingRaytracer; 
+#pragma link C++ class nurfana::raytracer::AnalyticExponentialRaytracer; 
+#pragma link C++ class nurfana::raytracer::RayTable; 
 
 
 //Digitizer 
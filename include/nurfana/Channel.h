@@ -17,6 +17,7 @@
 #include "nurfana/Response.h" 
 #include "nurfana/Digitizer.h" 
 #include "TNamed.h" 
+#include <utility> 
 
 namespace nurfana
 {
@@ -39,8 +40,45 @@ namespace nurfana
         digitizer_ = digitizer; 
         timing_group_ =timing_group; 
       }
+
+      /** Channels own their waveform, so they can be moved but not copied */ 
+      Channel(Channel && other) 
+        : TNamed(other) 
+      {
+        wf_ = other.wf_; 
+        ant_ = other.ant_; 
+        response_ = other.response_; 
+        digitizer_ = other.digitizer_; 
+        timing_group_ = other.timing_group_; 
+        other.wf_ = 0; 
+      }
+
+      Channel & operator=(Channel && other) 
+      {
+        TNamed::operator=(other); 
+        std::swap(wf_, other.wf_); 
+        ant_ = other.ant_; 
+        response_ = other.response_; 
+        digitizer_ = other.digitizer_; 
+        timing_group_ = other.timing_group_; 
+        return *this; 
+      }
+
+      Channel(const Channel &) = delete; 
+      Channel & operator=(const Channel &) = delete; 
       
+      /** Points the channel at a (possibly different) antenna, response and digitizer, keeping the waveform. 
+       * Readers use this to recycle channels between events. */ 
+      void reset(const Antenna * antenna, const Response * response, const Digitizer * digitizer, int timing_group = 0) 
+      {
+        ant_ = antenna; 
+        response_ = response; 
+        digitizer_ = digitizer; 
+        timing_group_ = timing_group; 
+      }
+
       Waveform * wf() { return wf_; } 
+      const Waveform * wf() const { return wf_; } 
       const Antenna * antenna() const  { return ant_; } 
       const Response * response() const { return response_; } 
       const Digitizer * digitizer() const { return digitizer_; }
@@ -1,30 +1,71 @@
 #ifndef _NURFANA_COMBINER_H
 #define _NURFANA_COMBINER_H
 
+#include "nurfana/Mapper.h"
+#include "nurfana/Event.h"
+#include <vector>
+#include <complex>
 
 namespace nurfana
-{
-  class Mapper; 
+{ 
 
-  class Combiner  
-  {
+  /** Coherent sums (beamforming).
+   *
+   * For a point X of the mapper, each channel is advanced by its delay relative to the reference channel (the first one used),
+   * so that a signal coming from X lines up, and the channels are summed. The sum is done in the frequency domain: each
+   * channel's spectrum (taken once per event) gets a phase ramp multiplied in and accumulated, and the sum takes a single inverse FFT,
+   * so delays don't have to be whole samples. As with ops::shift, the shifts are circular.
+   *
+   * The channels must have the same number of samples and sampling rate, but may start at different times.
+   * The sums are sampled like the reference channel, and are plain sums (not averages).
+   * Channels the mapper can't use at X (see Mapper::canUseAntenna) are left out there.
+   */ 
+  class Combiner
+  { 
+    public:
+      Combiner(const Mapper & mapper) : m_(&mapper), N_(0), df_(0), t0_(0), nthreads_(0) { ; } 
 
-    public: 
+      /** Sets the channels to sum. If they are not set, all of them will be used */ 
+      void setChannels(int nchan, const int * channels) { c_.assign(channels, channels+nchan); } 
+      std::vector<int> & channels() { return c_; } //so you can use assign or whatever
 
-      Combiner (const Mapper & mapper) : mapper_(mapper); 
-      Waveform * combine(const Event & event, const double * X); 
-      Waveform * combine(const Event & event, double x, double y =0, double z =0) 
-      {
-        double X[3] = {x,y,z}; 
-        combine(event,X);
-      }
+      /** Number of threads used by combineMany. 0 means use all cores */ 
+      void setNThreads(int n) { nthreads_ = n; } 
 
-    private: 
-      const Mapper & mapper_; 
+      /** The coherent sum at X (ndim() coordinates). The mapper must already have its event template set.
+       * If out is given, it is filled and returned, otherwise a new Waveform is. Returns NULL if the channels can't be summed. */ 
+      Waveform * combine(const Event & event, const double * X, Waveform * out = 0); 
+      Waveform * combine(const Event & event, double x, double y = 0, double z = 0, Waveform * out = 0) 
+      { double X[3] = {x,y,z}; return combine(event, X, out); } 
 
-  }; 
+      /** The coherent sums at npoints points (X holds ndim() coordinates for each), e.g. for emulating a phased-array trigger
+       * with many beams. Each channel's spectrum is only taken once and the points are spread over the threads.
+       * The sums go to out, N() samples per point, starting at t0() with spacing dt(). Returns 0 on success. */ 
+      int combineMany(const Event & event, size_t npoints, const double * X, double * out); 
 
+      /** The sampling of the sums of the last event */ 
+      size_t N() const { return N_; } 
+      double dt() const { return N_ ? 1. / (N_ * df_) : 0; } 
+      double t0() const { return t0_; } 
 
+    private:
+      Combiner(const Combiner &) = delete; 
+      Combiner & operator=(const Combiner &) = delete; 
+      int setup(const Event & event); 
+      void sumPoints(size_t npoints, const double * X, double * out) const; 
+      int nThreads() const; 
 
+      const Mapper * m_; 
+      std::vector<int> c_; 
+      std::vector<int> used_c_; 
+      std::vector<int> ref_; // the reference channel, once per used channel, for Mapper::getDelays
+      std::vector<const std::complex<double> *> Y_; 
+      std::vector<double> t0s_; 
+      size_t N_; 
+      double df_; 
+      double t0_; 
+      int nthreads_; 
+  }; 
+} 
 
-}
+#endif
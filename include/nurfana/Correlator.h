@@ -5,8 +5,11 @@
 #include "nurfana/Event.h" 
 #include <vector> 
 
+class TH1; 
+
 namespace nurfana
 {
+  class DelayTable; 
 
   class Correlator
   {
@@ -31,19 +34,105 @@ namespace nurfana
         {;} 
       }; 
 
+      /** The location and value of the map maximum */ 
+      struct Peak
+      {
+        Peak() : val(0), index(0) { ; } 
+        double val; 
+        size_t index; /// point index, as in the DelayTable 
+        std::vector<double> X; /// coordinates (bin center) 
+      }; 
+
       Correlator( const Mapper & mapper, int nranges, const Range * ranges); 
+      virtual ~Correlator(); 
 
       /** Sets the channels used in the correlation. 
        * If they are not set, all of them will be used */ 
       void setChannels (int nchan, const int * channels) { c_.assign(channels, channels+nchan) ; }
       std::vector<int>  & channels() { return c_; } //so you can use assign or whatever
+
+      /** Number of threads used to correlate and fill the map. 0 means use all cores */ 
+      void setNThreads(int n) { nthreads_ = n; } 
+
+      /** If true (the default), each pairwise correlation is normalized by the product of the waveform norms */ 
+      void setNormalize(bool norm) { normalize_ = norm; } 
+
+      /** Correlates all pairs of channels and fills the map. The mapper must already have its event template set. 
+       *  The delay table is built on the first call (and again if the channels change). */ 
       void correlate(const Event & ev); 
-      const TH1 * getHist() const { return h_; }
+
+      /** The map values, in DelayTable point order (first axis fastest) */ 
+      const double * getMap() const { return &map_[0]; } 
+      size_t nPoints() const { return map_.size(); } 
+
+      /** The peak of the last map */ 
+      const Peak & getPeak() const { return peak_; } 
+
+      /** Returns the map as a histogram (made on demand, up to 3 dimensions) */ 
+      const TH1 * getHist() const; 
+
+      /** Only computes the pairwise correlations (correlate and search do this themselves). 
+       * After this, evaluate may be used. */ 
+      void correlatePairs(const Event & ev); 
+
+      /** Evaluates the map at an arbitrary point X, using the cached pairwise correlations. 
+       * This is what the map would have at X, except for the delays not being tabulated. */ 
+      double evaluate(const double * X) const; 
+
+      /** Hierarchical (coarse-to-fine) peak search, for when the full map would be too big. 
+       *
+       * The ranges given to the constructor define the finest grid. The search starts with coarse_steps[i] cells 
+       * along each axis (by default, 1/16 of the fine steps, but at least 1), evaluated at the fine bin nearest each cell center. 
+       * The best topk cells are kept and each is split into (up to) factor parts along each axis, 
+       * until the cells are single fine bins. 
+       *
+       * The result is the same as from correlate (index and X refer to the fine grid) and agrees with the dense 
+       * peak as long as the peak is among the topk candidates at every level. The map itself is not filled. 
+       *
+       * By default this is a heuristic: if the true peak's cell loses to topk others at some level, the search ends up 
+       * at a different (local) maximum. Then make the coarse cells no bigger than about half the width of the correlation peak 
+       * in map coordinates, and make topk at least the number of competing maxima (sidelobes, or e.g. direct and reflected solutions) 
+       * you expect within a few percent of the peak value. The number of points evaluated is 
+       * about (coarse cells) + topk * factor^ndim * log_factor(fine/coarse steps). 
+       *
+       * If bounded is true, topk is ignored and each cell also gets an upper bound on the map over its fine bins: 
+       * for each pair, the largest correlation sample over the delays the cell spans (estimated from a 3^ndim grid of 
+       * points in the cell, widened by ndim/8 of the range, which covers delays that are up to quadratic across the cell). 
+       * Only cells whose bound is below the best value already found are dropped, so the result is the dense peak 
+       * (up to the float rounding of the delay table) whenever the delays are that smooth over each cell. 
+       * This costs 3^ndim delay evaluations per cell, and keeps more cells when the map has many near-equal maxima. 
+       *
+       * macro/checkSearch.C compares both with the dense peak on synthetic events. 
+       **/ 
+      const Peak & search(const Event & ev, const unsigned * coarse_steps = 0, int topk = 8, int factor = 4, bool bounded = false); 
+
+      /** Access to the delay table (only made by correlate) and the cached pairwise correlations of the last event */ 
+      const DelayTable * getDelayTable() const { return table_; } 
+      unsigned nPairs() const { return pairs_.size(); } 
+      int first(unsigned pair) const { return pairs_[pair].first; } 
+      int second(unsigned pair) const { return pairs_[pair].second; } 
+      const Waveform * getCorrelation(unsigned pair) const { return corrs_[pair]; } 
+
     private: 
-      TH1 * h_; 
+      void setup(const Event & ev); 
+      void findPeak(); 
+      int nThreads() const; 
+
+      mutable TH1 * h_; 
+      mutable bool h_dirty_; 
       std::vector<Range> r_; 
       std::vector<int> c_; 
+      std::vector<int> used_c_; 
+      std::vector<std::pair<int,int> > pairs_; 
       const Mapper * m_;
+      DelayTable * table_; 
+      std::vector<Waveform*> corrs_; 
+      std::vector<const double*> corr_ptrs_; 
+      bool corr_ok_; 
+      std::vector<double> map_; 
+      Peak peak_; 
+      int nthreads_; 
+      bool normalize_; 
   }; 
 }
 
@@ -0,0 +1,100 @@
+#ifndef _NURFANA_DELAY_TABLE_H
+#define _NURFANA_DELAY_TABLE_H
+
+/** A DelayTable caches the delays a Mapper gives for each channel pair at each point of a grid.
+ *
+ * Since the antenna geometry doesn't change from event to event, this can be built once (e.g. per run) 
+ * and then filling a map is just a gather over the pairwise correlations.
+ *
+ * The grid is defined by a set of Correlator::Range's, using the bin centers (the same as a TH1/TH2/TH3
+ * with those ranges would have). Points are numbered with the first axis varying fastest.
+ *
+ */ 
+
+#include "nurfana/Correlator.h"
+#include <vector>
+
+namespace nurfana
+{ 
+
+  class DelayTable
+  { 
+    public:
+
+      /** Builds the table for the given mapper (which must already have its event template set) and grid.
+       * If channels is given, only pairs among those channels are used, otherwise all channels of the mapper are.
+       * Pairs that the mapper says can't be used together are skipped.
+       */ 
+      DelayTable(const Mapper & m, int nranges, const Correlator::Range * ranges, int nchan = 0, const int * channels = 0); 
+
+      unsigned ndim() const { return r_.size(); } 
+      size_t nPoints() const { return npoints_; } 
+      unsigned nPairs() const { return pairs_.size(); } 
+      const Correlator::Range & range(unsigned dim) const { return r_[dim]; } 
+
+      /** The channels making up a pair */ 
+      int first(unsigned pair) const { return pairs_[pair].first; } 
+      int second(unsigned pair) const { return pairs_[pair].second; } 
+
+      /** Returns the point index for the given bin along each axis (0-indexed) */ 
+      size_t index(const unsigned * bins) const; 
+
+      /** Fills bins with the bin along each axis for the point */ 
+      void bins(size_t point, unsigned * bins) const; 
+
+      /** Fills X with the coordinates of the point */ 
+      void point(size_t point, double * X) const; 
+
+      /** The delays (in ns) for this pair at every grid point. NaN where the mapper says one of the antennas can't be used. */ 
+      const float * delays(unsigned pair) const { return &delays_[pair * npoints_]; } 
+
+      /** Sets how the correlation for this pair is sampled (correlation value k at time t0 + k * dt, N samples).
+       * This precomputes the interpolation indices and weights, so it's only (re)done if the sampling changes.
+       **/ 
+      void setSampling(unsigned pair, double t0, double dt, size_t N); 
+      void setSampling(double t0, double dt, size_t N) { for (unsigned i = 0; i < nPairs(); i++) setSampling(i, t0, dt, N); } 
+
+      /** The lower sample index for each grid point and the linear interpolation weights for it and the next sample,
+       * so that the interpolated value is w0 * c[k] + w1 * c[k+1]. For points where the pair isn't usable
+       * k = 0 and both weights are 0, so the gather doesn't need any branches.
+       **/ 
+      const int * indices(unsigned pair) const { return &idx_[pair * npoints_]; } 
+      const float * lowerWeights(unsigned pair) const { return &w0_[pair * npoints_]; } 
+      const float * upperWeights(unsigned pair) const { return &w1_[pair * npoints_]; } 
+      bool usable(unsigned pair, size_t point) const { return usable_[pair * npoints_ + point]; } 
+
+      /** The number of pairs usable at each grid point, with the current sampling */ 
+      const unsigned short * nValid() const { return &nvalid_[0]; } 
+
+      /** Fills out[i-start] for points start <= i < end with the average over usable pairs of the
+       * interpolated correlations. corr[pair] must point to the samples of that pair's correlation, sampled as
+       * given to setSampling. If end is 0, all points are filled. Points with no usable pairs get 0.
+       *
+       * Different ranges may be filled from different threads at the same time.
+       **/ 
+      void fill(const double * const * corr, double * out, size_t start = 0, size_t end = 0) const; 
+
+    private:
+      std::vector<Correlator::Range> r_; 
+      std::vector<size_t> strides_; 
+      size_t npoints_; 
+      std::vector<std::pair<int,int> > pairs_; 
+      std::vector<float> delays_; 
+
+      struct Sampling
+      { 
+        Sampling() : t0(0), dt(0), N(0) { ; } 
+        double t0; 
+        double dt; 
+        size_t N; 
+      }; 
+      std::vector<Sampling> sampling_; 
+      std::vector<int> idx_; 
+      std::vector<float> w0_; 
+      std::vector<float> w1_; 
+      std::vector<unsigned char> usable_; 
+      std::vector<unsigned short> nvalid_; 
+  }; 
+} 
+
+#endif
@@ -45,6 +45,7 @@ namespace nurfana
 
     public: 
       virtual int nEvents() const = 0; 
+      virtual ~Reader() { ; } 
 
       int next() { return get(current_entry_+1); }
       int previous() { return get(current_entry_-1); }
@@ -57,15 +58,20 @@ namespace nurfana
         return current_entry_; 
       }
 
-     virtual Event::Header & header(bool force = false) { if (force || loaded_meta_ != current_entry_) loadMeta(current_entry_); return ev_.meta_; }
+     virtual Event::Header & header(bool force = false) { if ((force || loaded_meta_ != current_entry_) && !loadMeta(current_entry_)) loaded_meta_ = current_entry_; return ev_.meta_; }
 
+     /** Loads the current entry if it isn't already. If that fails, the event is left in whatever state loadEvent left it, 
+      * so check eventLoaded() before using it. */ 
      virtual Event & event(bool force = false) 
       {
         header(force); 
-        if (force || loaded_event_ != current_entry_) loadEvent(current_entry_); 
+        if (force || loaded_event_ != current_entry_) loaded_event_ = loadEvent(current_entry_) ? -1 : current_entry_; 
         return ev_;
       }
 
+     /** Whether the last event() holds the current entry, i.e. it was loaded successfully */ 
+     bool eventLoaded() const { return loaded_event_ == current_entry_; } 
+
 
     protected:
       Reader () 
@@ -80,12 +86,44 @@ namespace nurfana
       virtual int loadMeta(int i) = 0; 
 
       std::vector<Channel> & channels() { return ev_.channels_; } 
+
+      /** Makes chans hold n channels, recycling channels (along with their waveforms and buffers) from previous events, so that 
+       * loading an event doesn't need to allocate anything once things have warmed up. Channels beyond n are put
+       * in a spare pool rather than destroyed. Channels that had to be created have an empty waveform and no antenna, response or digitizer, 
+       * so the caller should always Channel::reset and fill the waveform (e.g. with Waveform::setEven). 
+       *
+       * This is not thread-safe; only one thread should be loading events for a given reader at a time. 
+       **/ 
+      void recycleChannels(std::vector<Channel> & chans, size_t n) 
+      {
+        while (chans.size() > n) 
+        {
+          spare_.push_back(std::move(chans.back())); 
+          chans.pop_back(); 
+        }
+
+        chans.reserve(n); 
+        while (chans.size() < n) 
+        {
+          if (spare_.size()) 
+          {
+            chans.push_back(std::move(spare_.back())); 
+            spare_.pop_back(); 
+          }
+          else
+          {
+            chans.emplace_back("", new Waveform(EvenRepresentation()), (const Antenna*) 0, (const Response*) 0, (const Digitizer*) 0); 
+          }
+        }
+      }
+
       Event::Header & meta() { return ev_.meta_; } 
 
       int current_entry_; 
       int loaded_event_; 
       int loaded_meta_ ;
       Event ev_; 
+      std::vector<Channel> spare_; 
   }; 
 
 
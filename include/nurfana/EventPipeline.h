@@ -0,0 +1,88 @@
+#ifndef _NURFANA_EVENT_PIPELINE_H
+#define _NURFANA_EVENT_PIPELINE_H
+
+/** Multi-threaded event processing. 
+ *
+ * A Reader owns a single Event that it reloads in place, so each worker thread gets 
+ * its own Reader (and therefore its own Event), made with a reader factory. 
+ *
+ * Entries are handed out to the workers in order. On its worker, each event goes through 
+ * all of the stages (in the order they were added), and then through the output, 
+ * which is either called in entry order or in whatever order events finish. 
+ *
+ */ 
+
+#include "nurfana/Event.h" 
+#include <functional> 
+#include <vector> 
+#include <mutex> 
+#include <condition_variable> 
+
+namespace nurfana
+{
+
+  class EventPipeline 
+  {
+    public: 
+
+      /** Makes a new reader. Called once per worker, always from the thread calling run() */ 
+      typedef std::function<Reader * ()> ReaderFactory; 
+
+      /** A processing stage (e.g. filtering, deconvolution, correlation ...). worker is the index of 
+       * the worker thread, in case the stage needs per-thread state. Returning false drops the event 
+       * (the remaining stages and the output are skipped). */ 
+      typedef std::function<bool (Event & ev, int entry, int worker)> Stage; 
+
+      /** Receives processed events. Never called concurrently. */ 
+      typedef std::function<void (Event & ev, int entry)> Output; 
+
+      /** Creates a pipeline. 
+       *
+       * @param factory used to make one reader per worker. The pipeline owns the readers. 
+       * @param nthreads the number of workers. If <= 0, the number of hardware threads is used. 
+       * @param max_in_flight the maximum number of events that may be read but not yet output. If <= 0, this is the number of workers. 
+       */ 
+      EventPipeline(ReaderFactory factory, int nthreads = 0, int max_in_flight = 0); 
+
+      /** Adds a stage. Stages run in the order they were added. */ 
+      void addStage(Stage stage) { stages_.push_back(stage); } 
+
+      /** Sets the output. If ordered is true, the output receives events in entry order. */ 
+      void setOutput(Output output, bool ordered = true) { output_ = output; ordered_ = ordered; } 
+
+      /** Processes entries first through last (inclusive, -1 for the last entry). Returns the number of events that made it through all of the stages. 
+       * Entries the reader fails to load are skipped (and not counted). */ 
+      int run(int first = 0, int last = -1); 
+
+      int nThreads() const { return nthreads_; } 
+
+      virtual ~EventPipeline(); 
+
+    private: 
+
+      EventPipeline(const EventPipeline &) = delete; 
+      EventPipeline & operator=(const EventPipeline &) = delete; 
+      void work(int worker); 
+
+      ReaderFactory factory_; 
+      int nthreads_; 
+      int max_in_flight_; 
+      std::vector<Reader*> readers_; 
+      std::vector<Stage> stages_; 
+      Output output_; 
+      bool ordered_; 
+
+      // run state, protected by m_
+      std::mutex m_; 
+      std::mutex output_m_; 
+      std::condition_variable cv_; 
+      int next_entry_; 
+      int last_entry_; 
+      int next_output_; 
+      int in_flight_; 
+      int nprocessed_; 
+  }; 
+
+}
+
+#endif
@@ -4,19 +4,104 @@
 /** Thread-safe FFTW3 interface */ 
 
 #include <complex> 
+#include <vector> 
+#include <new> 
 
 namespace nurfana
 {
   namespace fft 
   {
-    /** Sets a wisdom file. Wisdom will be loaded from and saved to this file */ 
+    /** Aligned memory allocation (via fftw_malloc). Arrays allocated this way may be
+     * transformed directly, without going through the internal scratch buffers. 
+     * */ 
+    void * allocAligned(size_t nbytes); 
+    void freeAligned(void * ptr); 
+
+    /** An STL allocator using allocAligned, so that e.g. std::vector storage may be transformed without copies */ 
+    template <typename T> 
+    struct allocator 
+    {
+      typedef T value_type; 
+      template <typename U> struct rebind { typedef allocator<U> other; }; 
+
+      allocator() { ; } 
+      template <typename U> allocator(const allocator<U> &) { ; } 
+
+      T * allocate(size_t n) 
+      {
+        void * p = allocAligned(n * sizeof(T)); 
+        if (!p && n) throw std::bad_alloc(); 
+        return (T*) p; 
+      }
+      void deallocate(T * p, size_t) { freeAligned(p); } 
+    }; 
+
+    template <typename T, typename U> 
+    inline bool operator==(const allocator<T> &, const allocator<U> &) { return true; } 
+    template <typename T, typename U> 
+    inline bool operator!=(const allocator<T> &, const allocator<U> &) { return false; } 
+
+    /** A vector with storage aligned for FFTW */ 
+    template <typename T> using aligned_vector = std::vector<T, allocator<T> >; 
+
+    /** Plan cache statistics */ 
+    struct CacheStats
+    {
+      CacheStats() : hits(0), misses(0), evictions(0), nplans(0), planning_time(0) { ; } 
+      size_t hits;  /// Number of times a plan was found in the cache 
+      size_t misses; /// Number of times a plan had to be made 
+      size_t evictions; /// Number of plans evicted from the cache 
+      size_t nplans; /// Number of plans currently in the cache 
+      double planning_time; /// Total time spent planning, in seconds 
+    }; 
+
+    /** Plans the transforms for these sizes up front (e.g. before starting worker threads), so that 
+     * the first event doesn't stall. Plans are shared between all threads. 
+     * If single_precision is true, the single-precision (fftwf) plans are prepared instead. */ 
+    void prepare(size_t nsizes, const size_t * sizes, size_t howmany = 1, bool single_precision = false); 
+    inline void prepare(size_t N, size_t howmany = 1, bool single_precision = false) { prepare(1, &N, howmany, single_precision); } 
+
+    /** Sets the maximum number of plans to keep around (the least recently used are evicted first). 
+     * 0 means unbounded. The default is 64. */ 
+    void setCacheCapacity(size_t max_plans); 
+
+    /** Removes all plans from the cache (they will be destroyed once nobody is using them) */ 
+    void clearCache(); 
+
+    /** Returns the plan cache statistics (summed over both precisions) */ 
+    CacheStats cacheStats(); 
+    void resetCacheStats(); 
+
+    /** Sets a wisdom file. Wisdom will be loaded from and saved to this file (single-precision wisdom goes to f.single) */ 
     void setWisdomFile(const char * f); 
 
-    /** Forward FFT */ 
+    /** Forward FFT. If both y and Y are aligned (e.g. allocated with allocAligned or an aligned_vector), 
+     * the transform is done directly between them. */ 
     void forward(size_t N, const double * y, std::complex<double> * Y); 
 
-    /** Inverse FFT. N is the time domain length (i.e. Y is N/2+1 long) */ 
+    /** Inverse FFT. N is the time domain length (i.e. Y is N/2+1 long). Y is always copied (since the c2r transform destroys its input),
+     * but the result is written directly to y if it is aligned */ 
     void inverse(size_t N, const std::complex<double> * Y, double * y); 
+
+    /** Batched forward FFT of howmany transforms of length N, done with a single plan execution 
+     * (e.g. all the channels of an event). 
+     *
+     * Transform i reads N samples starting at y + i * stride and writes N/2+1 values starting at Y + i * fstride. 
+     * If stride is 0, N is used. If fstride is 0, N/2+1 is used. 
+     */ 
+    void forwardMany(size_t N, size_t howmany, size_t stride, const double * y, std::complex<double> * Y, size_t fstride = 0); 
+
+    /** Batched inverse FFT, the counterpart of forwardMany. Transform i reads N/2+1 values starting at Y + i * fstride and 
+     * writes N samples starting at y + i * stride. 
+     */ 
+    void inverseMany(size_t N, size_t howmany, size_t stride, const std::complex<double> * Y, double * y, size_t fstride = 0); 
+
+
+    /** Single-precision (fftwf) versions of the above. These use their own plans, but otherwise behave the same way.*/ 
+    void forward(size_t N, const float * y, std::complex<float> * Y); 
+    void inverse(size_t N, const std::complex<float> * Y, float * y); 
+    void forwardMany(size_t N, size_t howmany, size_t stride, const float * y, std::complex<float> * Y, size_t fstride = 0); 
+    void inverseMany(size_t N, size_t howmany, size_t stride, const std::complex<float> * Y, float * y, size_t fstride = 0); 
   }
 }
 
@@ -13,6 +13,7 @@
 #include "TAttLine.h" 
 #include "TAttMarker.h" 
 #include "nurfana/Interpolation.h" 
+#include "nurfana/FFT.h" 
 #include <complex> 
 
 namespace nurfana
@@ -85,7 +86,7 @@ namespace nurfana
      size_t Nt_; 
      double t0_; 
      double df_; 
-     std::vector<std::complex<double> > Y_; 
+     fft::aligned_vector<std::complex<double> > Y_; //aligned so that the FFT can be done without copies 
 
      mutable std::vector<double> f_; // needed for inteprolation
      mutable bool unwrapped_invalid_; 
@@ -103,7 +104,7 @@ namespace nurfana
      Interpolator * interp_re_; 
      Interpolator * interp_im_; 
 
-     ClassDef(FrequencyRepresentation,1); 
+     ClassDef(FrequencyRepresentation,2); 
   }; 
 
 
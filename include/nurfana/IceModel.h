@@ -20,12 +20,16 @@ namespace nurfana
      * internal state, each component of the ice model 
      * is its own abstract class. This kind of sucks, but 
      * oh well. 
+     *
+     * Each also has a batch version (e.g. nMany), which by default just loops, 
+     * but lets models with a simple form avoid a virtual call per point and vectorize. 
      * */ 
 
     class DensityModel
     {
       public:
         virtual double density(double z_m) const = 0; 
+        virtual void densityMany(size_t N, const double * z_m, double * out) const { for (size_t i = 0; i < N; i++) out[i] = density(z_m[i]); } 
         static const DensityModel & getDefault(); 
         virtual int getDepthsWithDensity(double rho, std::vector<double> & depths) const =0; 
         virtual ~DensityModel() { ; } 
@@ -35,6 +39,7 @@ namespace nurfana
     {
       public:
         virtual double n(double z_m) const = 0; 
+        virtual void nMany(size_t N, const double * z_m, double * out) const { for (size_t i = 0; i < N; i++) out[i] = n(z_m[i]); } 
         static const RefractionModel & getDefault(); 
         virtual int getDepthsWithN(double n, std::vector<double> & depths) const = 0;
         virtual ~RefractionModel() { ; } 
@@ -44,6 +49,7 @@ namespace nurfana
     {
       public:
         virtual double attenuation(double z, double f_GHz = 0.3) const = 0; 
+        virtual void attenuationMany(size_t N, const double * z_m, double * out, double f_GHz = 0.3) const { for (size_t i = 0; i < N; i++) out[i] = attenuation(z_m[i], f_GHz); } 
         static const AttenuationModel & getDefault(); 
         virtual ~AttenuationModel() { ; } 
     };
@@ -64,6 +70,9 @@ namespace nurfana
         double density(double z_m) const { return density_.density(z_m); } 
         double attenuation(double z_m, double f_GHz = 0.3) const { return attenuation_.attenuation(z_m,f_GHz); } 
         double n(double z_m) const { return refraction_.n(z_m); } 
+        void densityMany(size_t N, const double * z_m, double * out) const { density_.densityMany(N, z_m, out); } 
+        void attenuationMany(size_t N, const double * z_m, double * out, double f_GHz = 0.3) const { attenuation_.attenuationMany(N, z_m, out, f_GHz); } 
+        void nMany(size_t N, const double * z_m, double * out) const { refraction_.nMany(N, z_m, out); } 
 
         double iceDepth() const { return iceDepth_; } 
         const DensityModel & densityModel() const { return density_ ; }
@@ -103,10 +112,16 @@ namespace nurfana
           : m_(m) { } 
 
         double n(double z_m) const { return m_.density(z_m) * 0.845 + 1; } 
+        virtual void nMany(size_t N, const double * z_m, double * out) const 
+        {
+          m_.densityMany(N, z_m, out); 
+          for (size_t i = 0; i < N; i++) out[i] = out[i] * 0.845 + 1; 
+        }
         virtual int getDepthsWithN(double n, std::vector<double> & depths) const
         {
           return m_.getDepthsWithDensity( (n-1)/0.845, depths); 
         }
+        const DensityModel & densityModel() const { return m_; } 
     private: 
         const  DensityModel & m_; 
     }; 
@@ -117,7 +132,12 @@ namespace nurfana
         RefractionDerivedDensityModel (const RefractionModel & m = RefractionModel::getDefault()) 
           : m_(m) { } 
 
-        double n(double z_m) const { return (m_.n(z_m)-1) / 0.845; } 
+        double density(double z_m) const { return (m_.n(z_m)-1) / 0.845; } 
+        virtual void densityMany(size_t N, const double * z_m, double * out) const 
+        {
+          m_.nMany(N, z_m, out); 
+          for (size_t i = 0; i < N; i++) out[i] = (out[i]-1) / 0.845; 
+        }
         virtual int getDepthsWithDensity(double rho, std::vector<double> & depths) const
         {
           return m_.getDepthsWithN( rho * 0.845 + 1, depths); 
@@ -138,7 +158,11 @@ namespace nurfana
          : a0_(a0), a1_(a1), b1_(b1) { }
 
         virtual double n(double z_m) const { return a0_ + a1_ * (1-exp(-b1_*z_m)); } 
+        virtual void nMany(size_t N, const double * z_m, double * out) const; 
         virtual int getDepthsWithN(double N, std::vector<double> & depths) const ; 
+        double a0() const { return a0_; } 
+        double a1() const { return a1_; } 
+        double b1() const { return b1_; } 
 
  
       private: 
@@ -155,7 +179,11 @@ namespace nurfana
          : a0_(a0), a1_(a1), b1_(b1) { }
 
         virtual double density(double z_m) const { return a0_ + a1_ * (1-exp(-b1_*z_m)); } 
+        virtual void densityMany(size_t N, const double * z_m, double * out) const; 
         virtual int getDepthsWithDensity(double rho, std::vector<double> & depths) const;
+        double a0() const { return a0_; } 
+        double a1() const { return a1_; } 
+        double b1() const { return b1_; } 
       private: 
         double a0_; 
         double a1_; 
@@ -170,9 +198,112 @@ namespace nurfana
       public: 
         ConstantAttenuationModel(double l = 1500) : l_(l) {} 
         virtual double attenuation(double z_m __attribute__((unused)), double f __attribute__((unused))) const { return l_; } 
+        virtual void attenuationMany(size_t N, const double * z_m __attribute__((unused)), double * out, double f __attribute__((unused)) = 0.3) const { for (size_t i = 0; i < N; i++) out[i] = l_; } 
+        double length() const { return l_; } 
       private: 
         double l_; 
     }; 
+
+
+    /** A function of one variable tabulated at evenly spaced points, with monotone (Fritsch-Carlson) cubic
+     * Hermite interpolation. Lookups are O(1). Outside the table, the end values are returned.
+     *
+     * This is what the tabulated models below are built on.
+     */ 
+    class TabulatedProfile
+    {
+      public: 
+        TabulatedProfile() : x0_(0), dx_(1), inv_dx_(1), monotone_(0) { ; } 
+
+        /** Use N values y at evenly spaced x in [xmin,xmax] */ 
+        void setUniform(int N, double xmin, double xmax, const double * y); 
+
+        /** Resample n (x,y) pairs, with x increasing but not necessarily evenly spaced, onto N evenly spaced points */ 
+        void setPoints(int n, const double * x, const double * y, int N); 
+
+        double eval(double x) const 
+        {
+          double t = (x - x0_) * inv_dx_; 
+          int last = y_.size() - 1; 
+          if (!(t > 0)) return y_[0]; 
+          if (t >= last) return y_[last]; 
+          int i = (int) t; 
+          double s = t - i; 
+          double s1 = 1 - s; 
+          return (1 + 2*s) * s1 * s1 * y_[i] + s * s1 * s1 * m_[i] + s * s * (3 - 2*s) * y_[i+1] - s * s * s1 * m_[i+1]; 
+        }
+
+        void evalMany(size_t N, const double * x, double * out) const { for (size_t i = 0; i < N; i++) out[i] = eval(x[i]); } 
+
+        /** Finds all x where the interpolated function equals y, appending them to xs. Returns the number found. */ 
+        int findX(double y, std::vector<double> & xs) const; 
+
+        int size() const { return y_.size(); } 
+        double xmin() const { return x0_; } 
+        double xmax() const { return x0_ + (y_.size()-1) * dx_; } 
+        const std::vector<double> & values() const { return y_; } 
+
+      private: 
+        void init(); 
+        double solveSegment(int i, double y) const; 
+
+        double x0_; 
+        double dx_; 
+        double inv_dx_; 
+        std::vector<double> y_; 
+        std::vector<double> m_;  // slopes, per step 
+
+        // for monotone profiles, the first segment for each of a set of evenly spaced y values 
+        int monotone_; // +1 increasing, -1 decreasing, 0 neither 
+        double inv_y0_; 
+        double inv_scale_; 
+        std::vector<int> inv_; 
+    }; 
+
+
+    /** A refractive index profile from a table. This can either cache another (e.g. slow or composite) model, 
+     * or interpolate measured data. Either way it is about as fast as the analytic models. */ 
+    class TabulatedRefractionModel : public RefractionModel 
+    {
+      public: 
+        /** Samples m at npoints evenly spaced depths in [0, zmax]. m is not needed afterwards. */ 
+        TabulatedRefractionModel(const RefractionModel & m, double zmax = 3000, int npoints = 3001); 
+
+        /** Interpolates measured n at N increasing depths z, resampled to npoints evenly spaced depths */ 
+        TabulatedRefractionModel(int N, const double * z, const double * n, int npoints = 1000); 
+
+        virtual double n(double z_m) const { return t_.eval(z_m); } 
+        virtual void nMany(size_t N, const double * z_m, double * out) const { t_.evalMany(N, z_m, out); } 
+        virtual int getDepthsWithN(double n, std::vector<double> & depths) const { return t_.findX(n, depths); } 
+        const TabulatedProfile & table() const { return t_; } 
+
+      private: 
+        TabulatedProfile t_; 
+    }; 
+
+
+    /** An attenuation length profile from a table, either caching another model or from measured data.
+     * Frequency dependence is tabulated at a few frequencies and interpolated linearly. */ 
+    class TabulatedAttenuationModel : public AttenuationModel 
+    {
+      public: 
+        /** Samples m at nz evenly spaced depths in [0,zmax] and nf evenly spaced frequencies in [fmin,fmax] */ 
+        TabulatedAttenuationModel(const AttenuationModel & m, double zmax = 3000, int nz = 601, 
+                                  double fmin = 0.1, double fmax = 1, int nf = 10); 
+
+        /** Interpolates a measured, frequency-independent, attenuation length L at N increasing depths z */ 
+        TabulatedAttenuationModel(int N, const double * z, const double * L, int npoints = 1000); 
+
+        virtual double attenuation(double z_m, double f_GHz = 0.3) const; 
+        virtual void attenuationMany(size_t N, const double * z_m, double * out, double f_GHz = 0.3) const; 
+
+      private: 
+        // the tables to use for f, and the weight of the second 
+        int bracket(double f, double * w) const; 
+        double fmin_; 
+        double df_; 
+        std::vector<TabulatedProfile> t_; 
+    }; 
   }
 }
 
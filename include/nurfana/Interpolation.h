@@ -6,13 +6,14 @@
  *
  * The Interpolator is responsible for interpolation. 
  * You should have one interpolator for each waveform you want to interpolate, as it potentially has internal state. 
+ * Evaluating is thread-safe, and doesn't lock: whatever an interpolator needs from its input is built the first 
+ * time it is evaluated and only read after that. Setting the input (which discards it) must not race evaluation. 
  *
  * One can either construct an interpolator directly, or use the make method. 
  *
  * */ 
 
 #include <vector> 
-#include "TMutex.h" 
 #include <gsl/gsl_spline.h> 
 
 namespace nurfana
@@ -24,7 +25,8 @@ namespace nurfana
   {
     kInterpDefault, 
     kInterpLinear,
-    kInterpGSL 
+    kInterpGSL, 
+    kInterpSinc 
   }; 
 
   class Interpolatable
@@ -44,8 +46,8 @@ namespace nurfana
   class Interpolator 
   {
     public: 
-      /** Set the input of the interpolator. This theoretically can be expensive
-       * depending on what the interpolator has to do */ 
+      /** Set the input of the interpolator. This should be called again whenever the input changes (TimeRepresentation does this for its own interpolator), 
+       *  since interpolators may keep things computed from it. */ 
       virtual void setInput(const Interpolatable* input)  { input_ = input; }
 
       /** Interpolate the input at value t */ 
@@ -56,9 +58,14 @@ namespace nurfana
 
       virtual double * evalMany(size_t N, const double * t, double *y = NULL, bool sorted = true) const = 0;
 
+      /** Interpolate the input at N evenly spaced values, t0 + i * dt. The output is treated as in evalMany. 
+       *  Interpolators that can take advantage of the even spacing override this; by default it just calls evalMany. */ 
+      virtual double * evalEven(size_t N, double t0, double dt, double * y = NULL) const; 
+
       /** Takes the times from a TimeRepresentation and fills the values */ 
       void eval(TimeRepresentation * out) const; 
 
+      Interpolator() : input_(0) { ; } 
       virtual ~Interpolator() { ;}
 
       /** Create an interpolator based on an interpolator type, and, if applicable, the interpolator options. 
@@ -82,31 +89,90 @@ namespace nurfana
 
 
 
-  /** Linear interpolator. */ 
+  /** Linear interpolator. Outside of the input, the first or last sample is returned. 
+   *
+   * Even input doesn't need a search for each output, and evenly spaced output from even input (evalEven) is 
+   * done with SIMD gathers, or, if the sampling is the same (as when delaying by a fraction of a sample), contiguously. */ 
   class LinearInterpolator : public Interpolator
   {
 
     public: 
       virtual double * evalMany(size_t N, const double * t, double *y = 0, bool sorted = true) const ;
+      virtual double * evalEven(size_t N, double t0, double dt, double * y = 0) const; 
       virtual InterpolationType type() const { return kInterpLinear; } 
       virtual const void * opt() const { return 0; } 
   };
 
-  /** Interpolator based on GSL classes */ 
+  struct sinc_table_t; 
+  struct sinc_grid_t; 
+
+  /** Band-limited interpolator, with a Kaiser-windowed sinc kernel. 
+   *
+   * For evenly sampled input, this is a polyphase filter: the kernel is tabulated at Options::nphases fractional 
+   * offsets per sample (and interpolated linearly between them), so each output is a dot product of 2 * half_width 
+   * consecutive samples with a table row. 
+   *
+   * Unevenly sampled input (e.g. from an IRS2-style digitizer) is first regridded when it is set: we find the evenly 
+   * spaced samples (at the least-squares fit to the sample times) which, interpolated as above, reproduce the input 
+   * at its actual sample times. This is solved iteratively, and converges quickly as long as the sample times stray 
+   * less than half a sample from the grid. If they stray further, each output instead gets the kernel evaluated at 
+   * the actual distances to its neighbors, with the weights normalized, which is only roughly band-limited. 
+   * The regridding is done the first time the input is evaluated after setInput. 
+   *
+   * Outside of the input, the first or last sample is returned, as with the LinearInterpolator. 
+   * The kernel tables are shared between all interpolators with the same options. 
+   */ 
+  class SincInterpolator : public Interpolator
+  {
+    public: 
+      struct Options 
+      {
+        Options(int hw = 8, double b = 8, int np = 512) : half_width(hw), beta(b), nphases(np) { ; } 
+        int half_width; /// samples used on each side (rounded up to an even number) 
+        double beta; /// shape parameter of the Kaiser window. Larger trades bandwidth for less ripple. 
+        int nphases; /// kernel table resolution, per sample 
+      }; 
+
+      SincInterpolator(const Options * opt = 0); 
+      virtual ~SincInterpolator(); 
+      virtual void setInput(const Interpolatable * input); 
+      virtual double * evalMany(size_t N, const double * t, double *y = 0, bool sorted = true) const ;
+      virtual double * evalEven(size_t N, double t0, double dt, double * y = 0) const; 
+      virtual InterpolationType type() const { return kInterpSinc; } 
+      /** Points to the Options, the same for all interpolators with the same options */ 
+      virtual const void * opt() const; 
+
+    protected: 
+      const sinc_grid_t * grid() const; 
+      const sinc_table_t * table_; 
+      mutable sinc_grid_t * grid_; /// regridded uneven input 
+
+    private: 
+      SincInterpolator(const SincInterpolator &) = delete; 
+      SincInterpolator & operator=(const SincInterpolator &) = delete; 
+  }; 
+
+
+  /** Interpolator based on GSL classes. 
+   *
+   * The spline is shared by all threads evaluating it, each call having its own accelerator. */ 
   class GSLInterpolator : public Interpolator
   {
     public: 
       GSLInterpolator(const gsl_interp_type * type = gsl_interp_akima); 
       virtual double * evalMany(size_t N, const double * t, double *y = 0, bool sorted = true) const ;
-      virtual void setInput(const TimeRepresentation* input);
+      virtual void setInput(const Interpolatable* input);
       virtual ~GSLInterpolator() ; 
       virtual InterpolationType type() const { return kInterpGSL; } 
       virtual const void * opt() const { return gsl_t_; } 
     protected: 
-      mutable gsl_spline * gsl_s_; 
+      const gsl_spline * spline() const; 
+      mutable gsl_spline * gsl_s_; /// built from the input on first use 
       const gsl_interp_type * gsl_t_; 
-      mutable gsl_interp_accel * gsl_a_; 
-      mutable TMutex m_; 
+
+    private: 
+      GSLInterpolator(const GSLInterpolator &) = delete; 
+      GSLInterpolator & operator=(const GSLInterpolator &) = delete; 
   }; 
 
 
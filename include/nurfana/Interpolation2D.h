@@ -13,7 +13,8 @@ namespace nurfana
    *
    * It needn't be even, but it must be regular
    *
-   * NOT THREAD SAFE (you must lock access to eval ) 
+   * NOT THREAD SAFE (you must lock access to eval ), except for bilinear interpolation 
+   * on an evenly-spaced grid, which is done directly without GSL (and is much faster). 
    *
    **/ 
   class GridInterpolator2D 
@@ -34,6 +35,11 @@ namespace nurfana
       GridInterpolator2D(int nx, double xmin, double xmax, int ny, double ymin, double ymax, const double * z = 0, Type t= Bicubic); 
       GridInterpolator2D(const TH2 & hist, Type t = Bicubic ); 
 
+      /** Makes an interpolator on an evenly-spaced grid that reads z in place instead of copying it
+       * (e.g. from a memory-mapped file). z must outlive the interpolator, and set() may not be used.
+       * With Bilinear interpolation, nothing is allocated for the grid at all. */ 
+      static GridInterpolator2D * makeView(int nx, double xmin, double xmax, int ny, double ymin, double ymax, const double * z, Type t = Bilinear); 
+
       virtual ~GridInterpolator2D(); 
 
 
@@ -49,9 +55,19 @@ namespace nurfana
 
       TH2 * hist(); 
 
+      /** True if eval is done with the direct (thread-safe) bilinear interpolation */ 
+      bool isFast() const { return uniform_ && t_ == Bilinear; } 
+
+      /** True if the grid values are not owned by the interpolator */ 
+      bool isView() const { return zv_ != (z_.size() ? &z_[0] : 0); } 
+
 
     private: 
+       // the view constructor 
+       GridInterpolator2D(int nx, double xmin, double xmax, int ny, double ymin, double ymax, const double * z, Type t, bool view); 
        void initGSL(); 
+       void setUniform(); 
+       double evalBilinear(double x, double y) const; 
        bool outOfBounds(double x, double y) const; 
        void setupInterp() const; 
        Type t_; 
@@ -61,10 +77,16 @@ namespace nurfana
        std::vector<double> x_; 
        std::vector<double> y_; 
        std::vector<double> z_; 
+       const double * zv_; // the grid values, either z_ or someone else's memory 
        TH2 * h_; 
        bool hist_ready_;
        mutable bool dirty_; 
 
+       // for the evenly-spaced fast path
+       bool uniform_; 
+       double x0_, dxinv_; 
+       double y0_, dyinv_; 
+
 
   }; 
 }
@@ -9,6 +9,8 @@
 
 #include "TVector3.h" 
 #include "nurfana/Event.h" 
+#include "nurfana/IceModel.h" 
+#include "nurfana/Interpolation2D.h" 
 #include <vector> 
 
 namespace nurfana
@@ -34,6 +36,10 @@ namespace nurfana
       /** Returns the delay for the channel pair at this position */ 
       virtual double getDelay(int i, int j, const double * X)  const= 0; 
 
+      /** Returns the delays for many pairs (first[p], second[p]) at many points. X holds npoints points of ndim() coordinates each
+       * and delays is filled as [pair][point]. The default just calls getDelay for each, but some mappers can do much better. */ 
+      virtual void getDelays(int npairs, const int * first, const int * second, size_t npoints, const double * X, double * delays) const; 
+
       /** Returns true if this pair of channels may be used together*/ 
       virtual bool   canUsePair(int i, int j)  const { (void) i; (void) j; return true;}
 
@@ -78,22 +84,77 @@ namespace nurfana
 
   }; 
 
-  /* Assumes antennas are azimuthally symmetric (i.e. a string) */
+  /* Assumes antennas are azimuthally symmetric (i.e. a string) 
+   *
+   * X = (r, depth), with r the horizontal distance from the string and depth positive downwards. 
+   *
+   * Propagation times are looked up in (r, depth) tables, one per distinct antenna depth, so getDelay is just two table lookups.
+   * By default the tables use straight-line propagation through n(z) (i.e. no ray bending), but better tables 
+   * (e.g. from a ray tracer) can be supplied with setTable. 
+   **/
   class IceRZMapper : public Mapper
   {
-   
+    public: 
+      /** The tables span 0 <= r <= max_r and 0 <= depth <= max_depth with nr x ndepth points. */ 
+      IceRZMapper(const ice::Model & ice, const Event * ev = 0, 
+                  int nr = 400, double max_r = 2000, int ndepth = 400, double max_depth = 1000); 
 
+      virtual void setEventTemplate(const Event & event); 
+      virtual double getDelay(int i, int j, const double * X)  const; 
+      virtual void getDelays(int npairs, const int * first, const int * second, size_t npoints, const double * X, double * delays) const; 
 
+      /** Only points inside the table can be used */ 
+      virtual bool canUseAntenna(int i, const double * X) const; 
 
-  };
+      /** The propagation time (ns) from X to antenna i */ 
+      double getTime(int i, const double * X) const; 
 
+      /** Replaces the propagation time table for antennas at this depth (x is r, y is depth). 
+       * The mapper takes ownership. Tables set before setEventTemplate are kept. 
+       * For thread safety, it should be a bilinear table on an evenly-spaced grid. */ 
+      void setTable(double antenna_depth, GridInterpolator2D * table); 
+      const GridInterpolator2D * getTable(int i) const { return tables_[ant_table_[i]]; } 
 
-  class IceRZPhiMapper : public Mapper
-  {
+      /** Makes a table assuming straight-line propagation */ 
+      GridInterpolator2D * makeStraightLineTable(double antenna_depth) const; 
+
+      virtual ~IceRZMapper(); 
+
+    protected: 
+      IceRZMapper(unsigned ndim, const ice::Model & ice, int nr, double max_r, int ndepth, double max_depth); 
 
+      /** The horizontal distance from X to antenna i */ 
+      virtual double horizontalDistance(int i, const double * X) const { (void) i; return X[0]; } 
 
+      const ice::Model & ice_; 
+      int nr_; 
+      double max_r_; 
+      int ndepth_; 
+      double max_depth_; 
 
+      std::vector<double> depths_; 
+      std::vector<GridInterpolator2D*> tables_; 
+      std::vector<int> ant_table_; 
 
+    private: 
+      IceRZMapper(const IceRZMapper &); 
+      IceRZMapper & operator=(const IceRZMapper &); 
+      int findTable(double depth) const; 
+  };
+
+
+  /** Like the IceRZMapper, but also taking into account the horizontal positions of the antennas. 
+   * X = (r, depth, phi), with r and phi (in degrees) measured from the origin of the station coordinates. 
+   * The tables need to extend far enough in r to include the antenna offsets. 
+   */ 
+  class IceRZPhiMapper : public IceRZMapper
+  {
+    public: 
+      IceRZPhiMapper(const ice::Model & ice, const Event * ev = 0, 
+                     int nr = 400, double max_r = 2000, int ndepth = 400, double max_depth = 1000); 
+
+    protected: 
+      virtual double horizontalDistance(int i, const double * X) const; 
   };
 
 
@@ -3,6 +3,10 @@
 
 #include "nurfana/Event.h" 
 #include "TChain.h" 
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #ifdef HAVE_NUPHASE
 #include "nuphaseEvent.h" 
@@ -22,6 +26,20 @@ namespace nurfana
 
       virtual int nEvents() const { return ch_hd_.GetEntries(); }
 
+      /** Enables asynchronous read-ahead. A background thread reads and decodes the next nahead events
+       * into a ring of pre-built channels, so that (for sequential access) next() and event() usually
+       * return without waiting for I/O or decompression. nahead = 0 disables read-ahead.
+       *
+       * Random access still works, but restarts the read-ahead from the requested entry.
+       */
+      void setPrefetch(int nahead);
+      int getPrefetch() const { return slots_.size(); }
+
+      /** Sets the TTreeCache size (in bytes) used for both the event and header chains. */
+      void setCacheSize(long bytes);
+
+      virtual ~PhasedArrayReader();
+
     protected:
       virtual int loadEvent(int i); 
       virtual int loadMeta(int i); 
@@ -31,10 +49,37 @@ namespace nurfana
       TChain ch_ev_; 
       TChain ch_hd_; 
 
+      // read-ahead state
+      struct Slot
+      {
+        Slot() : entry(-1), ready(false), status(0) { ; }
+        int entry;
+        bool ready;
+        int status;
+        std::vector<Channel> channels;
+      };
+
+      void stopPrefetch();
+      void prefetchLoop(int nev);
+
+      std::vector<TString> hd_files_;
+      long cache_size_;
+      TChain * pf_hd_;  //the read-ahead thread gets its own header chain
+      std::vector<Slot> slots_;
+      std::thread pf_thread_;
+      std::mutex pf_m_;
+      std::condition_variable pf_cv_;
+      int pf_start_; // first entry the consumer may still want
+      int pf_next_;  // next entry to read ahead
+      int pf_gen_;   // incremented whenever the read-ahead is restarted
+      bool pf_stop_;
+
 #ifdef HAVE_NUPHASE
+      int fillChannels(std::vector<Channel> & channels, nuphase::Event * ev, const nuphase::Header * hd);
       nuphase::Event * npEv_; 
       nuphase::Header * npHd_; 
-#endif 
+      nuphase::Header * pfHd_;
+#endif
   }; 
 
 
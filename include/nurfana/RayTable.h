@@ -0,0 +1,129 @@
+#ifndef _NURFANA_RAY_TABLE_H
+#define _NURFANA_RAY_TABLE_H
+
+/** Tabulated ray tracing solutions.
+ *
+ * A RayTable holds the direct and refracted (or surface-reflected) solutions from a fixed receiver depth z0
+ * to a grid of source depths and horizontal distances, for a given ice model. Building one takes a
+ * while (it is spread over all cores), so tables may be saved to a file. The file is keyed by a hash
+ * of the ice model (sampled over the table depths), the grid and the raytracer options, so a stale
+ * file is never used by accident.
+ *
+ * The file is laid out so it can be used in place: a page-sized header followed by one contiguous,
+ * 64-byte aligned grid per (branch, quantity), in native byte order. Loading a file just maps it
+ * read-only, so there is no parsing at startup and processes using the same file share the memory
+ * through the page cache.
+ *
+ */ 
+
+#include "nurfana/Raytracing.h"
+#include "nurfana/Interpolation2D.h"
+#include <vector>
+#include <stdint.h>
+
+namespace nurfana
+{ 
+  namespace raytracer
+  { 
+
+    class RayTable
+    { 
+      public:
+
+        enum Branch
+        { 
+          kDirect = 0,
+          kRefracted = 1, // one turn, either in the firn or at the surface
+          kNBranches = 2
+        }; 
+
+        /** The stored quantities. The attenuation factor for Options::atten_fs[i] is kAtten + i. */ 
+        enum Quantity
+        { 
+          kTime = 0,   // ns
+          kTheta0,     // zenith angle at z0 (the receiver), radians
+          kTheta1,     // zenith angle at the source, radians
+          kPathLength, // m
+          kAtten       // amplitude attenuation factor
+        }; 
+
+        /** Builds the table from a receiver at depth z0 to sources at nz depths in [zmin,zmax] and nd horizontal distances in [0,dmax].
+         * If nthreads is 0, all cores are used. The raytracer comes from Raytracer::make. */ 
+        RayTable(const ice::Model & ice, double z0,
+                 int nz, double zmin, double zmax, int nd, double dmax,
+                 const Options & opt = Options::defaultOptions(), int nthreads = 0); 
+
+        /** Maps a table from file. Returns NULL if the file doesn't exist or doesn't match the arguments */ 
+        static RayTable * load(const char * file, const ice::Model & ice, double z0,
+                               int nz, double zmin, double zmax, int nd, double dmax,
+                               const Options & opt = Options::defaultOptions()); 
+
+        /** Loads the table from file if possible, otherwise builds it and saves it there */ 
+        static RayTable * make(const char * file, const ice::Model & ice, double z0,
+                               int nz, double zmin, double zmax, int nd, double dmax,
+                               const Options & opt = Options::defaultOptions(), int nthreads = 0); 
+
+        /** Saves to a file. It is written to a uniquely-named temporary in the same directory, synced and renamed, 
+         * so readers (or other processes saving the same table) never see a partial file. Returns 0 on success */ 
+        int save(const char * file) const; 
+
+        ~RayTable(); 
+
+        /** True if the table is memory-mapped from a file */ 
+        bool isMapped() const { return map_ != 0; } 
+
+        int nz() const { return nz_; } 
+        int nd() const { return nd_; } 
+        double zmin() const { return zmin_; } 
+        double zmax() const { return zmax_; } 
+        double dmax() const { return dmax_; } 
+        double z0() const { return z0_; } 
+        unsigned nQuantities() const { return nq_; } 
+        double z(int iz) const { return zmin_ + iz * (zmax_ - zmin_) / (nz_-1); } 
+        double d(int id) const { return id * dmax_ / (nd_-1); } 
+        uint64_t key() const { return key_; } 
+
+        /** The values of a quantity on the grid (distance varying fastest). NaN where there is no solution. */ 
+        const double * data(Branch b, int q) const { return base_ + ((size_t) b * nq_ + q) * grid_stride_; } 
+        double at(Branch b, int q, int iz, int id) const { return data(b,q)[iz * nd_ + id]; } 
+
+        /** Bilinear interpolation. NaN outside the table or if any of the neighboring points has no solution. */ 
+        double get(Branch b, int q, double z, double d) const; 
+
+        /** Makes a bilinear interpolator (x = distance, y = depth) for one quantity, e.g. for IceRZMapper::setTable
+         * (being bilinear on an even grid, it can be evaluated from several threads at once).
+         * Where there is no solution, the other branch is used if fallback is true, otherwise (or if there is no solution there either) fill is.
+         **/ 
+        GridInterpolator2D * makeInterpolator(Branch b, int q, bool fallback = true, double fill = 0) const; 
+
+        /** Makes a bilinear interpolator that reads the table in place (NaN where there is no solution).
+         * The table must outlive it. */ 
+        GridInterpolator2D * makeView(Branch b, int q) const; 
+
+        static uint64_t computeKey(const ice::Model & ice, double z0, int nz, double zmin, double zmax, int nd, double dmax, const Options & opt); 
+
+      private:
+        RayTable() : base_(0), map_(0), map_len_(0) { ; } 
+        RayTable(const RayTable &) = delete; 
+        RayTable & operator=(const RayTable &) = delete; 
+        void build(const ice::Model & ice, const Options & opt, int nthreads); 
+        void setStride(); 
+
+        int nz_; 
+        int nd_; 
+        unsigned nq_; 
+        double zmin_; 
+        double zmax_; 
+        double dmax_; 
+        double z0_; 
+        uint64_t key_; 
+        size_t grid_stride_; // doubles between grids, padded for alignment 
+        std::vector<double> data_; // when built in memory 
+        const double * base_; 
+        void * map_; // when mapped from a file 
+        size_t map_len_; 
+    }; 
+  } 
+} 
+
+#endif
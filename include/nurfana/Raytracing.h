@@ -2,8 +2,9 @@
 #define _NURFANA_RAYTRACING_H
 
 
-#include "nurfana/Interpolation2D.h" 
+#include "nurfana/IceModel.h"
 #include <vector> 
+#include <cfloat>
 
 class TGraph; 
 
@@ -11,9 +12,6 @@ class TGraph;
 namespace nurfana
 {
 
-  class IceModel; 
-
-
   namespace raytracer 
   {
       //Options for a raytracer 
@@ -23,7 +21,8 @@ namespace nurfana
           double Rsurface = 6356752.3 + 2836; 
           bool flatEarth() const { return Rsurface <= 0 || Rsurface >= DBL_MAX; } 
           std::vector<double> atten_fs = {0.3 }; 
-          const Options & defaultOptions(); 
+          double rel_tolerance = 1e-7; /// relative tolerance for the integrals
+          static const Options & defaultOptions(); 
       }; 
 
 
@@ -43,32 +42,30 @@ namespace nurfana
         public: 
           Turns(unsigned num_turns = 0, 
                 const unsigned * num_skips = 0) 
-          :    nturns_(num_turns), nskips_(0)
+          :    nturns_(num_turns) 
           {
-            if (num_skips) nskips_ = new std::vector<unsigned>( num_skips, num_skips + num_turns); 
+            if (num_skips) nskips_.assign( num_skips, num_skips + num_turns); 
           }
 
-          ~Turns() { if (nskips_) delete nskips_; } 
-
           unsigned getNTurns() const { return nturns_; } 
-          unsigned getNSkips(unsigned i) const { return nskips_ ? nskips_[i] : 0; } 
+          unsigned getNSkips(unsigned i) const { return nskips_.size() ? nskips_[i] : 0; } 
 
           static const Turns & turnsWithNoSkip(unsigned i); 
 
         private: 
           unsigned nturns_; 
-          std::vector<unsigned> * nskips_ = 0; 
+          std::vector<unsigned> nskips_; 
 
       }; 
-      
-    
+
+
       //A raytracer solution 
       struct Solution 
       {
           double z0;  //start depth
           double z1;  //end depth
-          double theta0; //start zenith angle
-          double theta1; //end zenith angle
+          double theta0; //start zenith angle (of the ray direction, leaving z0) 
+          double theta1; //end zenith angle (of the ray direction, arriving at z1) 
           double t;  // time 
           double s;  // total distance
           double d;  // surface distance
@@ -76,85 +73,163 @@ namespace nurfana
           double alpha; // the ray parameter 
           Turns turns; 
           std::vector<double> turning_points; 
-          std::vector<std::pair<double,double> > attenuation_v_F; 
+          std::vector<std::pair<double,double> > attenuation_v_F; // (frequency, amplitude attenuation factor) 
           Options opt; 
       }; 
 
 
 
-    /** An spherically symmetric ray tracer (you can force a flat Earth too, if you want, by setting Rsurface <=0 ))  
-     *  using numerical integration with the cubature library. 
+    /** Common interface for the raytracers.
      *
-     *   The assumption is that we have a spherically symmetric index of refraction n(z), where z is the depth below the spherical surface R; 
-     *
-     *    We fix z0, since usually you care about raytracing to a fixed point. 
-     *
-     *    Once you've calculated enough nearby points, this can start interpolating if you'd like. 
+     *  We fix z0, since usually you care about raytracing to a fixed point. Raytracers have no mutable
+     *  state, so they may be used from multiple threads at once.
      *
+     *  Subclasses must implement computeRay. The rest have generic implementations in terms of it, which
+     *  may be overridden if something better is possible.
      **/ 
-    class IntegratingRaytracer  
+    class Raytracer
     {
-
       public: 
-         
-                IntegratingRaytracer(const IceModel & icemodel, double z0, const Options & opt = Options::defaultOptions()) 
-                             
+
+          Raytracer(const ice::Model & icemodel, double z0, const Options & opt = Options::defaultOptions()); 
+          virtual ~Raytracer() { ; } 
+
+          /** Makes the fastest raytracer that can handle this ice model and options. The caller owns it. */ 
+          static Raytracer * make(const ice::Model & icemodel, double z0, const Options & opt = Options::defaultOptions()); 
 
           /* Solve the raytracing problem from z0 to z, at distance d, with nturns turns.
            *
            * Returns NULL if no solution. If solution is passed it will be filled if there is a solution)
            *
            * */ 
-          Solution * solve(double z, double d, const Turns & = Turns::turnsWithNoSkip(0), Solution * solution = 0); 
+          Solution * solve(double z, double d, const Turns & turns = Turns::turnsWithNoSkip(0), Solution * solution = 0) const; 
 
-          /** Advanced helper.
+          /** Solves from z0 to N sources at (z[i], d[i]), spread over nthreads threads (0 to use all cores).
            *
-           * Not really for public use
-           * but it's here anyway
-           *
-           * But I won't bother documenting. 
+           * The sources are sorted by depth and distance, so that each root finding starts from its neighbor's solution.
+           * found[i], if not NULL, says whether solutions[i] was filled. Returns the number of solutions found.
            **/ 
-          int computeRay(double z, double alpha, 
-                         double * t, double * d,
-                         double * s, double * A, 
-                         const Turns * turns = 0, 
-                         const double * turning_points = 0,
-                         double * save_turns = 0 
-                         ); 
-
+          size_t solveMany(size_t N, const double * z, const double * d, Solution * solutions, bool * found = 0,
+                           const Turns & turns = Turns::turnsWithNoSkip(0), int nthreads = 0) const; 
 
-
-          /** This will find the ith turning point for the current ray  from the current depth. For a 
-           * complicated firn model (with layers) there may be lots of potential turning points, 
-           * in which case you can skip some using the i parameter. 
+          /** Advanced helper.
            *
-           * If no turning point can be found, the surface or bedrock  will be returned (i.e. the surface).
+           * Integrates the ray with parameter alpha from z0 to z, with nturns turns. Any of the outputs may be NULL; if only d is
+           * requested, only d is integrated. A must have room for one value per attenuation frequency and
+           * gets the amplitude attenuation factor. The turning points are saved in save_turns if it is not NULL.
            *
-           **/
-          double findTurningPoint(double alpha,  double z, bool up, int i = 0) ; 
+           * Returns 0 on success.
+           **/ 
+          virtual int computeRay(double z, double alpha, unsigned nturns,
+                                 double * t, double * d,
+                                 double * s = 0, double * A = 0,
+                                 double * save_turns = 0
+                                 ) const = 0; 
 
+          /** This will find the turning point for a ray with parameter alpha going up from depth z.
+           *
+           * If no turning point can be found, the surface will be returned.
+           **/ 
+          virtual double findTurningPoint(double alpha, double z) const; 
 
+          /** The largest ray parameter that can connect z0 and z */ 
+          virtual double maxAlpha(double z) const; 
 
-          double computeAlpha(double d, double z, unsigned nturns = 0); //returns negative if no solution 
+          double computeAlpha(double d, double z, unsigned nturns = 0) const { return findAlpha(d, z, nturns, 0); } //returns negative if no solution
 
+          double z0() const { return z0_; } 
+          const ice::Model & ice() const { return ice_; } 
+          const Options & options() const { return opt_; } 
 
-      private: 
+      protected:
 
-          //This caches solutions.
-          struct Cache
+          /** What previous solutions at the same depth tell us, so solveMany doesn't start each root finding from scratch */ 
+          struct AlphaHint
           {
-            std::vector<double> turning_points; 
-            
+            AlphaHint() : nturns(0), z(NAN), d_max(NAN), alpha(-1), d(0) { ; } 
+            unsigned nturns; 
+            double z;      // the depth the rest is for
+            double d_max;  // the distance reached with the largest alpha
+            double alpha;  // the last solution (negative if none)
+            double d;      // and its distance
+          }; 
+
+          /** Finds the ray parameter for distance d, using and updating hint if not NULL. Returns negative if there is no solution. */ 
+          virtual double findAlpha(double d, double z, unsigned nturns, AlphaHint * hint) const; 
+
+          Solution * solveHinted(double z, double d, const Turns & turns, Solution * solution, AlphaHint * hint) const; 
 
-          };
+          /** The starting bracket for findAlpha, f = distance - d at each end. Returns false if d is out of reach. */ 
+          bool bracketAlpha(double d, double z, unsigned nturns, AlphaHint * hint, double & lo, double & flo, double & hi, double & fhi) const; 
 
-          const IceModel & ice_; 
+          const ice::Model & ice_; 
           double z0_; 
           Options opt_; 
+    }; 
 
-          //used for computing turning points 
-          std::vector<double> depths_; 
 
+    /** An spherically symmetric ray tracer (you can force a flat Earth too, if you want, by setting Rsurface <=0 ))  
+     *  using numerical integration with the cubature library. 
+     *
+     *   The assumption is that we have a spherically symmetric index of refraction n(z), where z is the depth below the spherical surface R; 
+     *   The curvature is included to first order in z/R.
+     *
+     *    Currently, direct (0 turns) and refracted or surface-reflected (1 turn) rays are supported, assuming that n increases with depth
+     *    (i.e. there is one turning point). Skipping layers is not supported yet.
+     *
+     **/ 
+    class IntegratingRaytracer : public Raytracer
+    {
+
+      public: 
+
+          IntegratingRaytracer(const ice::Model & icemodel, double z0, const Options & opt = Options::defaultOptions()); 
+
+          virtual int computeRay(double z, double alpha, unsigned nturns,
+                                 double * t, double * d,
+                                 double * s = 0, double * A = 0,
+                                 double * save_turns = 0
+                                 ) const; 
+    }; 
+
+
+    /** A flat-Earth raytracer for an exponential index of refraction profile, n = a0 + a1 (1 - exp(-b z)),
+     *  either from an ice::ExponentialRefractionModel or an ice::DensityDerivedRefractionModel on top of an
+     *  ice::ExponentialDensityModel (like the default model).
+     *
+     *  The time, distance and path length integrals are done in closed form and the ray parameter is found with a
+     *  safeguarded Newton iteration, which is much faster than IntegratingRaytracer. Attenuation is exact for a
+     *  ConstantAttenuationModel, and otherwise done with fixed-order Gauss-Legendre quadrature.
+     *
+     *  The Earth's curvature is ignored, whatever Options::Rsurface says.
+     **/ 
+    class AnalyticExponentialRaytracer : public Raytracer
+    {
+      public: 
+
+          AnalyticExponentialRaytracer(const ice::Model & icemodel, double z0, const Options & opt = Options::defaultOptions()); 
+
+          /** Returns true if the ice model has an exponential profile, optionally filling in its parameters */ 
+          static bool canHandle(const ice::Model & icemodel, double * a0 = 0, double * a1 = 0, double * b = 0); 
+
+          virtual int computeRay(double z, double alpha, unsigned nturns,
+                                 double * t, double * d,
+                                 double * s = 0, double * A = 0,
+                                 double * save_turns = 0
+                                 ) const; 
+
+          virtual double findTurningPoint(double alpha, double z) const; 
+          virtual double maxAlpha(double z) const; 
+
+      protected:
+          virtual double findAlpha(double d, double z, unsigned nturns, AlphaHint * hint) const; 
+
+      private: 
+          bool ok_; 
+          double A_; // n at infinite depth, a0 + a1
+          double a1_; 
+          double b_; 
+          double atten_length_; // > 0 if the attenuation length is constant
     }; 
   }
 }
@@ -162,4 +237,3 @@ namespace nurfana
 
 
 #endif
-
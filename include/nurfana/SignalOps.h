@@ -8,6 +8,8 @@
 /** Here we define a whole bunch of operations on signals */ 
 namespace nurfana
 {
+  class Event; 
+
   namespace ops
   {
 
@@ -23,8 +25,21 @@ namespace nurfana
 
     /** Computes the correlation of A and B, putting it in out.
      * It is safe for out to equal either A or B. 
+     * The frequency domain is padded by a factor npad (if non-zero) and the result is divided by scale. 
+     * Zero delay ends up in the middle of the output. 
      **/ 
-    Waveform * correlation(const Waveform * A, const Waveform * B, Waveform * out = 0); 
+    Waveform * correlation(const Waveform * A, const Waveform * B, int npad = 0, double scale = 1, Waveform * out = 0); 
+
+
+    /** Delays the samples of wf by delay (in the units of t, and not necessarily a whole number of samples), 
+     *  keeping its sampling and t0. This is done in the frequency domain, with a linear phase ramp, so it's exact 
+     *  for a band-limited signal, but circular: whatever is delayed past the end wraps around to the beginning. 
+     *  (Pad first if that matters.) To just relabel the times instead, use setT0. 
+     **/ 
+    void shift(Waveform & wf, double delay); 
+
+    /** Shifts each channel of ev by the corresponding delay, as above. */ 
+    void shift(Event & ev, const std::vector<double> & delays); 
 
 
   /** Computes what I call the Impulsivity Measure of a signal
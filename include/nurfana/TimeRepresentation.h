@@ -11,12 +11,14 @@
 
 
 #include <vector> 
+#include <cmath> 
 #include "TNamed.h" 
 #include "nurfana/Interpolation.h" 
 #include "TAttFill.h" 
 #include "TAttLine.h" 
 #include "TAttMarker.h" 
 #include "TMutex.h" 
+#include "nurfana/FFT.h" 
 class TGraph; 
 
 namespace nurfana
@@ -41,10 +43,10 @@ namespace nurfana
       
 
       /** Resize to N. If longer than current size, new samples will all be zero */ 
-      virtual void resize(size_t N) { y_.resize(N); } 
+      virtual void resize(size_t N) { y_.resize(N); invalidate(); } 
 
-      /** Returns a modifiable pointer to the sample value array */
-      double * updateY() { ; return &y_[0]; } 
+      /** Returns a modifiable pointer to the sample value array. The interpolator is reset, so don't hold on to it past your changes. */
+      double * updateY() { invalidate(); return &y_[0]; } 
 
       /** Returns the time at the given sample */ 
       virtual double t(size_t i) const { return t_[i]; }
@@ -57,10 +59,10 @@ namespace nurfana
       /** Returns the difference between a sample and the next sample. No range checking is performed, so will cause problems for i == N()-1. */ 
       virtual double dt(size_t i) const { return  t_[i+1] - t_[i]; }
 
-      /** Returns the smallest sample greater than or equal to t.
+      /** Returns the index of the first sample at or after t (N() if there is none).
        *
-       * If start is non-zero, then we only consider the subsample starting at start. This is mainly useful if you
-       * have a previous lower bound to reduce the search space of a binary search in the uneven case. 
+       * If start is non-zero, then we only consider the samples from start on (the index returned is still from the beginning). 
+       * This is mainly useful if you have a previous lower bound to reduce the search space of a binary search in the uneven case. 
        *  
        **/ 
       virtual size_t lower_bound(double t, size_t start = 0) const; 
@@ -78,6 +80,17 @@ namespace nurfana
       double getMean(int start = 0, int end = -1) const; 
       double getRMS(int start = 0, int end = -1) const; 
 
+      /** Everything above, from one pass over the samples */ 
+      struct Stats
+      {
+        double peak;          /// as getPeak 
+        unsigned peak_index; 
+        double sum; 
+        double sum2;          /// as getSumV2 
+        double mean;          /// sum over the number of samples in [start,end] 
+      }; 
+      Stats getStats(int start = 0, int end = -1, bool use_abs = false) const; 
+
 
       TimeRepresentation & operator *(double x); 
       TimeRepresentation & operator /(double x); 
@@ -95,11 +108,11 @@ namespace nurfana
       TimeRepresentation(const FrequencyRepresentation & other);  
       TimeRepresentation & operator=(const FrequencyRepresentation & other);  
       virtual ~TimeRepresentation(); 
-      std::vector<double> y_; 
+      fft::aligned_vector<double> y_; /**Aligned so that the FFT can be done without copies */
       mutable std::vector<double> t_; /**This is mutable because it may be cached */
-      virtual void invalidate() { interp_->setInput(this); } 
+      virtual void invalidate() { if (interp_) interp_->setInput(this); } 
       Interpolator * interp_; 
-      ClassDef(TimeRepresentation,1); 
+      ClassDef(TimeRepresentation,2); 
   }; 
 
 
@@ -120,7 +133,7 @@ namespace nurfana
 
           UnevenRepresentation(UnevenRepresentation && move); 
 
-          virtual double * updateT() {  return &t_[0]; }
+          virtual double * updateT() { invalidate(); return &t_[0]; }
           bool amIReallyEven() const; 
           double nominalDT() const { return nominal_dt_; }
 
@@ -145,13 +158,16 @@ namespace nurfana
       EvenRepresentation & operator=(const FrequencyRepresentation & assign); 
       EvenRepresentation & operator=(const EvenRepresentation & assign); 
 
-      virtual void resize(size_t N) { invalidateT();  y_.resize(N); } 
+      /** Overwrites the samples (and sampling), reusing the existing storage if it is big enough */ 
+      void set(size_t N, const double * y, double dt, double t0 = 0); 
+
+      virtual void resize(size_t N) { invalidateT();  y_.resize(N); invalidate(); } 
       virtual void pad(size_t n) { resize((1+n)*N()); } 
 
-      virtual size_t lower_bound(double t, size_t start = 0) const { (void) start; return (t-t0())/dt(); }; 
+      virtual size_t lower_bound(double t, size_t start = 0) const { (void) start; double x = ceil((t-t0())/dt()); return !(x > 0) ? 0 : x < N() ? (size_t) x : N(); }; 
 
-      void setDT(double dt) { dt_ = dt; invalidateT(); } 
-      void setT0(double t0) { t0_ = t0; invalidateT(); } 
+      void setDT(double dt) { dt_ = dt; invalidateT(); invalidate(); } 
+      void setT0(double t0) { t0_ = t0; invalidateT(); invalidate(); } 
 
       double dt(size_t i = 0) const {(void) i;  return dt_; } 
       double t0() const { return t0_; } 
@@ -166,7 +182,7 @@ namespace nurfana
       volatile mutable bool t_dirty_; 
       void invalidateT() { t_dirty_ = true; }
       mutable TMutex m_; 
-      ClassDef(EvenRepresentation,1); 
+      ClassDef(EvenRepresentation,2); 
   }; 
 
 
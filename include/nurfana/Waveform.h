@@ -47,6 +47,10 @@ namespace nurfana
       Waveform(const FrequencyRepresentation & freq); 
       Waveform(FrequencyRepresentation && freq); 
 
+      /** Copies. The hilbert transform and envelope are not copied, they are just recomputed when needed. */ 
+      Waveform(const Waveform & other); 
+      Waveform & operator=(const Waveform & other); 
+
 
       /** Draw this waveform. By default, will draw the type of waveform used for initialization 
        * Other options: 
@@ -62,12 +66,17 @@ namespace nurfana
      /* Returns the hilbert transform of the waveform */ 
       const Waveform & hilbertTransform() const; 
      
+      /** Returns the Hilbert envelope, |x + iH(x)|, sampled like even(). This does not make the hilbertTransform() */ 
       const EvenRepresentation & envelope() const; 
 
 
       const EvenRepresentation & even() const; 
       EvenRepresentation & updateEven(); 
 
+      /** Replaces the contents with evenly-sampled data, reusing the existing storage. 
+       * Useful for recycling a waveform for the next event. */ 
+      void setEven(size_t N, const double * y, double dt, double t0 = 0); 
+
 
       const UnevenRepresentation & uneven() const; 
       UnevenRepresentation & updateUneven() ; 
@@ -110,7 +119,7 @@ namespace nurfana
       mutable FrequencyRepresentation freq_;
       mutable Waveform *hilbert_; 
       mutable EvenRepresentation *envelope_; 
-      ClassDef(Waveform,1); 
+      ClassDef(Waveform,2); 
   }; 
  
 }
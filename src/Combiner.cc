@@ -0,0 +1,136 @@
+#include "nurfana/Combiner.h"
+#include "nurfana/FFT.h"
+#include "nurfana/Logging.h"
+#include "nurfana_private.h"
+#include "nurfana_simd.h"
+#include "TMath.h"
+#include <cmath>
+#include <algorithm>
+
+
+namespace nurfana
+{ 
+
+  //points per task in combineMany. The delays of a tile are asked of the mapper together.
+  static const size_t tile_size = 16; 
+
+  int Combiner::nThreads() const
+  { 
+    int nthreads = nthreads_ > 0 ? nthreads_ : std::thread::hardware_concurrency(); 
+    return nthreads > 0 ? nthreads : 1; 
+  } 
+
+
+  int Combiner::setup(const Event & ev) 
+  { 
+    used_c_ = c_; 
+    if (!used_c_.size()) for (unsigned i = 0; i < ev.nChannels(); i++) used_c_.push_back(i); 
+    if (!used_c_.size()) 
+    { 
+      log::out(log::LOG_WARN, "Combiner: no channels to combine\n"); 
+      return 1; 
+    } 
+    ref_.assign(used_c_.size(), used_c_[0]); 
+
+    //the spectra are computed here, before the waveforms are shared between threads
+    Y_.resize(used_c_.size()); 
+    t0s_.resize(used_c_.size()); 
+    for (unsigned i = 0; i < used_c_.size(); i++) 
+    { 
+      const Waveform * wf = ev.channel(used_c_[i])->wf(); 
+      const FrequencyRepresentation & F = wf->freq(); 
+      if (i == 0) 
+      { 
+        N_ = F.Nt(); 
+        df_ = F.df(); 
+        t0_ = F.t0(); 
+      } 
+      else if (F.Nt() != N_ || fabs(F.df() - df_) > 1e-9 * df_) 
+      { 
+        log::out(log::LOG_WARN, "Combiner: channel %d is not sampled like channel %d\n", used_c_[i], used_c_[0]); 
+        N_ = 0; 
+        return 1; 
+      } 
+      Y_[i] = F.Y(); 
+      t0s_[i] = F.t0(); 
+    } 
+
+    if (!N_) 
+    { 
+      log::out(log::LOG_WARN, "Combiner: the waveforms are empty\n"); 
+      return 1; 
+    } 
+    return 0; 
+  } 
+
+
+  void Combiner::sumPoints(size_t npoints, const double * X, double * out) const
+  { 
+    size_t nchan = used_c_.size(); 
+    size_t Nf = N_/2 + 1; 
+    std::vector<double> delays(nchan * npoints); 
+    m_->getDelays(nchan, &used_c_[0], &ref_[0], npoints, X, &delays[0]); 
+
+    fft::aligned_vector<std::complex<double> > sum(Nf), w(Nf); 
+    std::vector<double> tmp(2 * (size_t) ceil(sqrt((double) Nf))); 
+    double * S = (double *) &sum[0]; 
+
+    for (size_t k = 0; k < npoints; k++) 
+    { 
+      const double * x = X + k * m_->ndim(); 
+      std::fill(sum.begin(), sum.end(), std::complex<double>(0,0)); 
+
+      for (size_t i = 0; i < nchan; i++) 
+      { 
+        double delay = delays[i * npoints + k]; 
+        if (std::isnan(delay) || !m_->canUseAntenna(used_c_[i], x)) continue; 
+
+        //sample j of the reference lines up with sample j + s/dt of this channel
+        double s = delay + t0_ - t0s_[i]; 
+        const double * Y = (const double *) Y_[i]; 
+        if (s == 0) 
+        { 
+          for (size_t j = 0; j < 2*Nf; j++) S[j] += Y[j]; 
+        } 
+        else
+        { 
+          simd::phase_ramp(Nf, 2 * TMath::Pi() * df_ * s, (double *) &w[0], &tmp[0]); 
+          simd::cmac(Nf, Y, (const double *) &w[0], S); 
+        } 
+      } 
+
+      //at the Nyquist frequency, the samples only see the real part
+      if (N_ % 2 == 0) sum[Nf-1] = sum[Nf-1].real(); 
+
+      fft::inverse(N_, &sum[0], out + k * N_); 
+    } 
+  } 
+
+
+  Waveform * Combiner::combine(const Event & ev, const double * X, Waveform * out) 
+  { 
+    if (setup(ev)) return 0; 
+
+    std::vector<double> y(N_); 
+    sumPoints(1, X, &y[0]); 
+
+    if (!out) return new Waveform(EvenRepresentation(N_, &y[0], dt(), t0_)); 
+    out->setEven(N_, &y[0], dt(), t0_); 
+    return out; 
+  } 
+
+
+  int Combiner::combineMany(const Event & ev, size_t npoints, const double * X, double * out) 
+  { 
+    if (setup(ev)) return 1; 
+
+    size_t ntiles = (npoints + tile_size - 1) / tile_size; 
+    parallel_for(ntiles, nThreads(), [&](size_t tile) 
+    { 
+      size_t k0 = tile * tile_size; 
+      sumPoints(std::min(tile_size, npoints - k0), X + k0 * m_->ndim(), out + k0 * N_); 
+    }); 
+    return 0; 
+  } 
+
+} 
@@ -0,0 +1,494 @@
+#include "nurfana/Correlator.h"
+#include "nurfana/DelayTable.h"
+#include "nurfana/SignalOps.h"
+#include "nurfana/Logging.h"
+#include "nurfana_private.h"
+#include "TH1.h"
+#include "TH2.h"
+#include "TH3.h"
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+
+namespace nurfana
+{ 
+
+  //points per tile when filling the map. Small enough to load balance, big enough to not matter
+  static const size_t tile_size = 4096; 
+
+  Correlator::Correlator(const Mapper & mapper, int nranges, const Range * ranges) 
+    : h_(0), h_dirty_(true), r_(ranges, ranges + nranges), m_(&mapper), table_(0), corr_ok_(false), nthreads_(0), normalize_(true) 
+  { 
+  } 
+
+  Correlator::~Correlator() 
+  { 
+    delete table_; 
+    delete h_; 
+    for (unsigned i = 0; i < corrs_.size(); i++) delete corrs_[i]; 
+  } 
+
+  int Correlator::nThreads() const 
+  { 
+    int nthreads = nthreads_ > 0 ? nthreads_ : std::thread::hardware_concurrency(); 
+    return nthreads > 0 ? nthreads : 1; 
+  } 
+
+
+  void Correlator::setup(const Event & ev) 
+  { 
+    std::vector<int> want = c_; 
+    if (!want.size()) for (unsigned i = 0; i < ev.nChannels(); i++) want.push_back(i); 
+
+    if (corrs_.size() && want == used_c_) return; 
+
+    //same pair order as the DelayTable 
+    used_c_ = want; 
+    pairs_.clear(); 
+    for (unsigned i = 0; i < used_c_.size(); i++) 
+    { 
+      for (unsigned j = i+1; j < used_c_.size(); j++) 
+      { 
+        if (m_->canUsePair(used_c_[i], used_c_[j])) pairs_.push_back(std::pair<int,int>(used_c_[i], used_c_[j])); 
+      } 
+    } 
+
+    delete table_; 
+    table_ = 0; 
+    for (unsigned i = 0; i < corrs_.size(); i++) delete corrs_[i]; 
+    corrs_.assign(pairs_.size(), (Waveform*) 0); 
+    corr_ptrs_.assign(pairs_.size(), (const double*) 0); 
+    map_.clear(); 
+  } 
+
+
+  void Correlator::correlatePairs(const Event & ev) 
+  { 
+    setup(ev); 
+
+    //make sure the spectra (and norms) are computed before the waveforms are shared between threads
+    std::vector<double> norm(ev.nChannels(), 1); 
+    for (unsigned i = 0; i < used_c_.size(); i++) 
+    { 
+      const Waveform * wf = ev.channel(used_c_[i])->wf(); 
+      wf->freq(); 
+      if (normalize_) norm[used_c_[i]] = sqrt(wf->even().getSumV2()); 
+    } 
+
+    //each pair is correlated once
+    parallel_for(pairs_.size(), nThreads(), [&](size_t p) 
+    { 
+      int i = pairs_[p].first; 
+      int j = pairs_[p].second; 
+      double scale = norm[i] * norm[j]; 
+      Waveform * c = ops::correlation(ev.channel(i)->wf(), ev.channel(j)->wf(), 0, scale ? scale : 1, corrs_[p]); 
+      //on failure the old buffer isn't returned, so it has to go here (getCorrelation then gives NULL) 
+      if (!c) delete corrs_[p]; 
+      corrs_[p] = c; 
+    }); 
+
+    corr_ok_ = true; 
+    for (unsigned p = 0; p < pairs_.size(); p++) 
+    { 
+      if (!corrs_[p]) 
+      { 
+        log::out(log::LOG_WARN, "Correlator: could not correlate channels %d and %d\n", pairs_[p].first, pairs_[p].second); 
+        corr_ok_ = false; 
+        continue; 
+      } 
+      corr_ptrs_[p] = corrs_[p]->even().y(); 
+    } 
+  } 
+
+
+  void Correlator::correlate(const Event & ev) 
+  { 
+    correlatePairs(ev); 
+
+    if (!table_) 
+    { 
+      table_ = new DelayTable(*m_, r_.size(), &r_[0], used_c_.size(), &used_c_[0]); 
+      map_.resize(table_->nPoints()); 
+    } 
+
+    h_dirty_ = true; 
+    peak_ = Peak(); 
+
+    if (!corr_ok_) 
+    { 
+      map_.assign(map_.size(), 0); 
+      return; 
+    } 
+
+    for (unsigned p = 0; p < table_->nPairs(); p++) 
+    { 
+      const EvenRepresentation & c = corrs_[p]->even(); 
+      table_->setSampling(p, c.t0(), c.dt(), c.N()); 
+    } 
+
+    //the map is filled in tiles
+    size_t ntiles = (table_->nPoints() + tile_size - 1) / tile_size; 
+    parallel_for(ntiles, nThreads(), [&](size_t tile) 
+    { 
+      size_t start = tile * tile_size; 
+      size_t end = std::min(start + tile_size, table_->nPoints()); 
+      table_->fill(&corr_ptrs_[0], &map_[start], start, end); 
+    }); 
+
+    findPeak(); 
+  } 
+
+
+  /* Returns the number of pairs that could be used */ 
+  static int evaluate_pairs(const Mapper * m, const std::vector<std::pair<int,int> > & pairs, 
+                            const std::vector<Waveform*> & corrs, const double * X, double * val) 
+  { 
+    double sum = 0; 
+    int n = 0; 
+    for (unsigned p = 0; p < pairs.size(); p++) 
+    { 
+      int i = pairs[p].first; 
+      int j = pairs[p].second; 
+      if (!m->canUseAntenna(i,X) || !m->canUseAntenna(j,X)) continue; 
+
+      const EvenRepresentation & c = corrs[p]->even(); 
+      double x = (m->getDelay(i,j,X) - c.t0()) / c.dt(); 
+      if (!(x >= 0 && x < c.N()-1)) continue; 
+
+      int k = (int) x; 
+      double w = x - k; 
+      sum += (1-w) * c.y(k) + w * c.y(k+1); 
+      n++; 
+    } 
+
+    *val = n ? sum / n : 0; 
+    return n; 
+  } 
+
+  double Correlator::evaluate(const double * X) const 
+  { 
+    double val = 0; 
+    if (corr_ok_) evaluate_pairs(m_, pairs_, corrs_, X, &val); 
+    return val; 
+  } 
+
+
+  /* An upper bound on the map over the fine bins whose centers are the npts points Xs (each with nd coordinates). 
+   * For each pair, the correlation can't be above its largest sample over the range of delays at Xs, 
+   * widened by pad times its width to allow for delays that bend between the points. 
+   * The map averages over whichever pairs are usable at a bin, so pairs that are only usable at some of the points 
+   * are only counted where they would raise the average. Returns -HUGE_VAL if no pair is usable at any of the points. */ 
+  static double bound_pairs(const Mapper * m, const std::vector<std::pair<int,int> > & pairs, const std::vector<Waveform*> & corrs, 
+                            size_t npts, unsigned nd, const double * Xs, double pad) 
+  { 
+    double sum = 0; 
+    int n = 0; 
+    std::vector<double> maybe; 
+
+    for (unsigned p = 0; p < pairs.size(); p++) 
+    { 
+      int i = pairs[p].first; 
+      int j = pairs[p].second; 
+      const EvenRepresentation & c = corrs[p]->even(); 
+
+      double dmin = HUGE_VAL, dmax = -HUGE_VAL; 
+      size_t nok = 0; 
+      for (size_t k = 0; k < npts; k++) 
+      { 
+        const double * X = Xs + k * nd; 
+        if (!m->canUseAntenna(i,X) || !m->canUseAntenna(j,X)) continue; 
+        double x = (m->getDelay(i,j,X) - c.t0()) / c.dt(); 
+        if (std::isnan(x)) continue; 
+        if (x >= 0 && x < c.N()-1) nok++; 
+        dmin = std::min(dmin, x); 
+        dmax = std::max(dmax, x); 
+      } 
+      if (dmin > dmax) continue; 
+
+      double w = dmax - dmin; 
+      double lo = floor(dmin - pad * w); 
+      double hi = ceil(dmax + pad * w); 
+      if (hi < 0 || lo > c.N() - 1.) continue; 
+      size_t klo = lo > 0 ? (size_t) lo : 0; 
+      size_t khi = hi < c.N() - 1. ? (size_t) hi : c.N() - 1; 
+
+      const double * y = c.y(); 
+      double u = y[klo]; 
+      for (size_t k = klo + 1; k <= khi; k++) u = std::max(u, y[k]); 
+
+      if (nok == npts) 
+      { 
+        sum += u; 
+        n++; 
+      } 
+      else maybe.push_back(u); 
+    } 
+
+    //the best average the uncertain pairs can make 
+    std::sort(maybe.begin(), maybe.end(), std::greater<double>()); 
+    for (unsigned k = 0; k < maybe.size(); k++) 
+    { 
+      if (n && maybe[k] * n <= sum) break; 
+      sum += maybe[k]; 
+      n++; 
+    } 
+
+    return n ? sum / n : -HUGE_VAL; 
+  } 
+
+
+  /* A box of fine bins, [lo,hi) along each axis */ 
+  struct SearchCell 
+  { 
+    std::vector<unsigned> lo; 
+    std::vector<unsigned> hi; 
+    double val; 
+    double bound; //only for bounded searches 
+    bool valid; 
+    bool evaluated; 
+
+    bool single() const 
+    { 
+      for (unsigned i = 0; i < lo.size(); i++) if (hi[i] - lo[i] > 1) return false; 
+      return true; 
+    } 
+
+    bool operator<(const SearchCell & other) const //better first 
+    { 
+      if (valid != other.valid) return valid; 
+      return val > other.val; 
+    } 
+  }; 
+
+  /* Splits cell into up to nsplit[i] parts along each axis, appending to out */ 
+  static void split_cell(const SearchCell & cell, const std::vector<unsigned> & nsplit, std::vector<SearchCell> & out) 
+  { 
+    unsigned nd = cell.lo.size(); 
+    std::vector<unsigned> n(nd); 
+    std::vector<unsigned> k(nd,0); 
+    for (unsigned i = 0; i < nd; i++) n[i] = std::min(nsplit[i], cell.hi[i] - cell.lo[i]); 
+
+    while (true) 
+    { 
+      SearchCell c; 
+      c.lo.resize(nd); 
+      c.hi.resize(nd); 
+      for (unsigned i = 0; i < nd; i++) 
+      { 
+        unsigned w = cell.hi[i] - cell.lo[i]; 
+        c.lo[i] = cell.lo[i] + (k[i] * w) / n[i]; 
+        c.hi[i] = cell.lo[i] + ((k[i]+1) * w) / n[i]; 
+      } 
+      c.val = 0; 
+      c.bound = 0; 
+      c.valid = false; 
+      c.evaluated = false; 
+      out.push_back(c); 
+
+      //increment the counter, first axis fastest
+      unsigned i = 0; 
+      while (i < nd && ++k[i] == n[i]) k[i++] = 0; 
+      if (i == nd) return; 
+    } 
+  } 
+
+  const Correlator::Peak & Correlator::search(const Event & ev, const unsigned * coarse_steps, int topk, int factor, bool bounded) 
+  { 
+    correlatePairs(ev); 
+    peak_ = Peak(); 
+    if (!corr_ok_ || !r_.size()) return peak_; 
+
+    unsigned nd = r_.size(); 
+    if (topk < 1) topk = 1; 
+    if (factor < 2) factor = 2; 
+
+    //the whole range is one big cell, which is then split into the coarse grid
+    SearchCell all; 
+    all.lo.assign(nd,0); 
+    all.hi.resize(nd); 
+    std::vector<unsigned> ncoarse(nd); 
+    for (unsigned i = 0; i < nd; i++) 
+    { 
+      all.hi[i] = r_[i].num_steps; 
+      ncoarse[i] = coarse_steps && coarse_steps[i] ? coarse_steps[i] : std::max(1u, r_[i].num_steps / 16); 
+    } 
+
+    std::vector<SearchCell> cells; 
+    split_cell(all, ncoarse, cells); 
+
+    std::vector<unsigned> nsplit(nd, factor); 
+    std::vector<SearchCell> next; 
+
+    //for the bounds, the delays are sampled on a 3^nd grid over each cell (first, middle and last fine bin along each axis). 
+    //A delay that is quadratic across the cell goes at most 1/8 of the sampled range beyond it per axis. 
+    size_t nbound = 1; 
+    for (unsigned i = 0; i < nd; i++) nbound *= 3; 
+    double pad = nd / 8.; 
+    double best = -HUGE_VAL; 
+
+    while (true) 
+    { 
+      parallel_for(cells.size(), nThreads(), [&](size_t ic) 
+      { 
+        SearchCell & c = cells[ic]; 
+        if (c.evaluated) return; 
+        std::vector<double> X(nd); 
+        for (unsigned i = 0; i < nd; i++) 
+        { 
+          unsigned b = (c.lo[i] + c.hi[i] - 1) / 2; 
+          X[i] = r_[i].min + (b + 0.5) * (r_[i].max - r_[i].min) / r_[i].num_steps; 
+        } 
+        c.valid = evaluate_pairs(m_, pairs_, corrs_, &X[0], &c.val) > 0; 
+        c.evaluated = true; 
+        if (!bounded) return; 
+
+        if (c.single()) 
+        { 
+          c.bound = c.valid ? c.val : -HUGE_VAL; 
+          return; 
+        } 
+        std::vector<double> Xs(nbound * nd); 
+        for (size_t k = 0; k < nbound; k++) 
+        { 
+          size_t kk = k; 
+          for (unsigned i = 0; i < nd; i++) 
+          { 
+            unsigned b = kk % 3 == 0 ? c.lo[i] : kk % 3 == 1 ? (c.lo[i] + c.hi[i] - 1) / 2 : c.hi[i] - 1; 
+            kk /= 3; 
+            Xs[k * nd + i] = r_[i].min + (b + 0.5) * (r_[i].max - r_[i].min) / r_[i].num_steps; 
+          } 
+        } 
+        c.bound = bound_pairs(m_, pairs_, corrs_, nbound, nd, &Xs[0], pad); 
+      }); 
+
+      if (bounded) 
+      { 
+        //every evaluated point is a value the map really has, so no cell bounded below the best of them can hold the peak. 
+        //The slack is for the bounds and values being summed in different orders. 
+        for (unsigned ic = 0; ic < cells.size(); ic++) if (cells[ic].valid) best = std::max(best, cells[ic].val); 
+        double cut = best - 1e-9 * fabs(best); 
+        cells.erase(std::remove_if(cells.begin(), cells.end(), [cut](const SearchCell & c) { return c.bound < cut; }), cells.end()); 
+        if (!cells.size()) return peak_; 
+        std::sort(cells.begin(), cells.end()); 
+      } 
+      else 
+      { 
+        size_t nkeep = std::min(cells.size(), (size_t) topk); 
+        std::partial_sort(cells.begin(), cells.begin() + nkeep, cells.end()); 
+        cells.resize(nkeep); 
+      } 
+
+      bool done = true; 
+      for (unsigned ic = 0; ic < cells.size(); ic++) if (!cells[ic].single()) done = false; 
+      if (done) break; 
+
+      next.clear(); 
+      for (unsigned ic = 0; ic < cells.size(); ic++) 
+      { 
+        if (cells[ic].single()) next.push_back(cells[ic]); 
+        else split_cell(cells[ic], nsplit, next); 
+      } 
+      cells.swap(next); 
+    } 
+
+    //cells are sorted best first. As in findPeak, ties go to the lowest index 
+    unsigned ibest = 0; 
+    size_t index = 0; 
+    for (unsigned ic = 0; ic < cells.size() && cells[ic].valid == cells[0].valid && cells[ic].val == cells[0].val; ic++) 
+    { 
+      size_t idx = 0, stride = 1; 
+      for (unsigned i = 0; i < nd; i++) 
+      { 
+        idx += cells[ic].lo[i] * stride; 
+        stride *= r_[i].num_steps; 
+      } 
+      if (ic == 0 || idx < index) 
+      { 
+        ibest = ic; 
+        index = idx; 
+      } 
+    } 
+
+    const SearchCell & bestcell = cells[ibest]; 
+    peak_.val = bestcell.val; 
+    peak_.index = index; 
+    peak_.X.resize(nd); 
+    for (unsigned i = 0; i < nd; i++) 
+    { 
+      peak_.X[i] = r_[i].min + (bestcell.lo[i] + 0.5) * (r_[i].max - r_[i].min) / r_[i].num_steps; 
+    } 
+
+    return peak_; 
+  } 
+
+
+  void Correlator::findPeak() 
+  { 
+    const unsigned short * nv = table_->nValid(); 
+    peak_ = Peak(); 
+    bool found = false; 
+
+    for (size_t i = 0; i < map_.size(); i++) 
+    { 
+      if (!nv[i]) continue; 
+      if (!found || map_[i] > peak_.val) 
+      { 
+        peak_.val = map_[i]; 
+        peak_.index = i; 
+        found = true; 
+      } 
+    } 
+
+    peak_.X.resize(r_.size()); 
+    table_->point(peak_.index, &peak_.X[0]); 
+  } 
+
+
+  const TH1 * Correlator::getHist() const
+  { 
+    if (!table_) return 0; 
+    if (!h_dirty_) return h_; 
+
+    if (!h_) 
+    { 
+      switch (r_.size()) 
+      { 
+        case 1:
+          h_ = new TH1D("correlator","Correlation Map", r_[0].num_steps, r_[0].min, r_[0].max); 
+          break; 
+        case 2:
+          h_ = new TH2D("correlator","Correlation Map", r_[0].num_steps, r_[0].min, r_[0].max,
+                                                       r_[1].num_steps, r_[1].min, r_[1].max); 
+          break; 
+        case 3:
+          h_ = new TH3D("correlator","Correlation Map", r_[0].num_steps, r_[0].min, r_[0].max,
+                                                       r_[1].num_steps, r_[1].min, r_[1].max,
+                                                       r_[2].num_steps, r_[2].min, r_[2].max); 
+          break; 
+        default:
+          log::out(log::LOG_WARN, "Correlator: can't make a histogram with %zu dimensions\n", r_.size()); 
+          return 0; 
+      } 
+      h_->SetDirectory(0); 
+      if (r_.size() > 0 && r_[0].name) h_->GetXaxis()->SetTitle(r_[0].name); 
+      if (r_.size() > 1 && r_[1].name) h_->GetYaxis()->SetTitle(r_[1].name); 
+      if (r_.size() > 2 && r_[2].name) h_->GetZaxis()->SetTitle(r_[2].name); 
+    } 
+
+    std::vector<unsigned> b(r_.size()); 
+    for (size_t i = 0; i < map_.size(); i++) 
+    { 
+      table_->bins(i, &b[0]); 
+      switch (r_.size()) 
+      { 
+        case 1: h_->SetBinContent(b[0]+1, map_[i]); break; 
+        case 2: h_->SetBinContent(b[0]+1, b[1]+1, map_[i]); break; 
+        default: h_->SetBinContent(b[0]+1, b[1]+1, b[2]+1, map_[i]); break; 
+      } 
+    } 
+
+    h_dirty_ = false; 
+    return h_; 
+  } 
+} 
@@ -0,0 +1,169 @@
+#include "nurfana/DelayTable.h"
+#include "nurfana/Logging.h"
+#include <cmath>
+#include <algorithm>
+
+namespace nurfana
+{ 
+
+  DelayTable::DelayTable(const Mapper & m, int nranges, const Correlator::Range * ranges, int nchan, const int * channels) 
+    : r_(ranges, ranges + nranges) 
+  { 
+    if ((unsigned) nranges != m.ndim()) 
+    { 
+      log::out(log::LOG_WARN, "DelayTable: %d ranges given, but the mapper has %u dimensions\n", nranges, m.ndim()); 
+    } 
+
+    npoints_ = 1; 
+    for (int i = 0; i < nranges; i++) 
+    { 
+      strides_.push_back(npoints_); 
+      npoints_ *= r_[i].num_steps; 
+    } 
+
+    std::vector<int> chans; 
+    if (nchan && channels) chans.assign(channels, channels + nchan); 
+    else for (unsigned i = 0; i < m.nChannels(); i++) chans.push_back(i); 
+
+    for (unsigned i = 0; i < chans.size(); i++) 
+    { 
+      for (unsigned j = i+1; j < chans.size(); j++) 
+      { 
+        if (m.canUsePair(chans[i], chans[j])) pairs_.push_back(std::pair<int,int>(chans[i], chans[j])); 
+      } 
+    } 
+
+    delays_.resize(pairs_.size() * npoints_); 
+    sampling_.resize(pairs_.size()); 
+    idx_.resize(pairs_.size() * npoints_, 0); 
+    w0_.resize(pairs_.size() * npoints_, 0); 
+    w1_.resize(pairs_.size() * npoints_, 0); 
+    usable_.resize(pairs_.size() * npoints_, 0); 
+    nvalid_.resize(npoints_, 0); 
+
+    // this is the expensive part, but it only has to happen once. Points are done in chunks, so that mappers can batch things 
+    const size_t chunk = 4096; 
+    std::vector<int> first(pairs_.size()); 
+    std::vector<int> second(pairs_.size()); 
+    for (unsigned p = 0; p < pairs_.size(); p++) 
+    { 
+      first[p] = pairs_[p].first; 
+      second[p] = pairs_[p].second; 
+    } 
+
+    std::vector<double> X(nranges * chunk); 
+    std::vector<double> d(pairs_.size() * chunk); 
+    for (size_t start = 0; start < npoints_; start += chunk) 
+    { 
+      size_t n = std::min(chunk, npoints_ - start); 
+      for (size_t k = 0; k < n; k++) point(start + k, &X[k * nranges]); 
+
+      if (pairs_.size()) m.getDelays(pairs_.size(), &first[0], &second[0], n, &X[0], &d[0]); 
+
+      for (unsigned p = 0; p < pairs_.size(); p++) 
+      { 
+        for (size_t k = 0; k < n; k++) 
+        { 
+          const double * x = &X[k * nranges]; 
+          bool ok = m.canUseAntenna(first[p], x) && m.canUseAntenna(second[p], x); 
+          delays_[p * npoints_ + start + k] = ok ? d[p * n + k] : NAN; 
+        } 
+      } 
+    } 
+  } 
+
+  size_t DelayTable::index(const unsigned * b) const
+  { 
+    size_t idx = 0; 
+    for (unsigned i = 0; i < ndim(); i++) idx += b[i] * strides_[i]; 
+    return idx; 
+  } 
+
+  void DelayTable::bins(size_t pt, unsigned * b) const
+  { 
+    for (unsigned i = 0; i < ndim(); i++) 
+    { 
+      b[i] = pt % r_[i].num_steps; 
+      pt /= r_[i].num_steps; 
+    } 
+  } 
+
+  void DelayTable::point(size_t pt, double * X) const
+  { 
+    for (unsigned i = 0; i < ndim(); i++) 
+    { 
+      unsigned b = pt % r_[i].num_steps; 
+      pt /= r_[i].num_steps; 
+      X[i] = r_[i].min + (b + 0.5) * (r_[i].max - r_[i].min) / r_[i].num_steps; 
+    } 
+  } 
+
+  void DelayTable::setSampling(unsigned pair, double t0, double dt, size_t N) 
+  { 
+    Sampling & s = sampling_[pair]; 
+    if (s.t0 == t0 && s.dt == dt && s.N == N) return; 
+
+    const float * d = delays(pair); 
+    int * idx = &idx_[pair * npoints_]; 
+    float * w0 = &w0_[pair * npoints_]; 
+    float * w1 = &w1_[pair * npoints_]; 
+    unsigned char * ok = &usable_[pair * npoints_]; 
+
+    for (size_t pt = 0; pt < npoints_; pt++) 
+    { 
+      if (ok[pt]) nvalid_[pt]--; 
+
+      double x = (d[pt] - t0) / dt; 
+      // the comparisons are false for NaN, so unusable points end up here too
+      if (!(x >= 0 && x < N-1)) 
+      { 
+        idx[pt] = 0; 
+        w0[pt] = 0; 
+        w1[pt] = 0; 
+        ok[pt] = 0; 
+        continue; 
+      } 
+
+      int k = (int) x; 
+      idx[pt] = k; 
+      w1[pt] = x - k; 
+      w0[pt] = 1 - w1[pt]; 
+      ok[pt] = 1; 
+      nvalid_[pt]++; 
+    } 
+
+    s.t0 = t0; 
+    s.dt = dt; 
+    s.N = N; 
+  } 
+
+  void DelayTable::fill(const double * const * corr, double * out, size_t start, size_t end) const
+  { 
+    if (!end) end = npoints_; 
+    size_t n = end - start; 
+
+    for (size_t i = 0; i < n; i++) out[i] = 0; 
+
+    for (unsigned p = 0; p < nPairs(); p++) 
+    { 
+      const double * c = corr[p]; 
+      const int * __restrict idx = indices(p) + start; 
+      const float * __restrict w0 = lowerWeights(p) + start; 
+      const float * __restrict w1 = upperWeights(p) + start; 
+      double * __restrict o = out; 
+
+      //no branches, so this turns into vector gathers where available
+      for (size_t i = 0; i < n; i++) 
+      { 
+        int k = idx[i]; 
+        o[i] += w0[i] * c[k] + w1[i] * c[k+1]; 
+      } 
+    } 
+
+    const unsigned short * nv = nValid() + start; 
+    for (size_t i = 0; i < n; i++) 
+    { 
+      if (nv[i]) out[i] /= nv[i]; 
+    } 
+  } 
+} 
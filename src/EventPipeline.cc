@@ -0,0 +1,111 @@
+#include "nurfana/EventPipeline.h" 
+#include "nurfana/Logging.h" 
+#include "TROOT.h" 
+#include <thread> 
+
+
+namespace nurfana
+{
+
+  EventPipeline::EventPipeline(ReaderFactory factory, int nthreads, int max_in_flight) 
+    : factory_(factory), nthreads_(nthreads), max_in_flight_(max_in_flight), ordered_(true) 
+  {
+    if (nthreads_ <= 0) nthreads_ = std::thread::hardware_concurrency(); 
+    if (nthreads_ <= 0) nthreads_ = 1; 
+    if (max_in_flight_ <= 0) max_in_flight_ = nthreads_; 
+
+    //each worker does its own I/O 
+    if (nthreads_ > 1) ROOT::EnableThreadSafety(); 
+  }
+
+  EventPipeline::~EventPipeline() 
+  {
+    for (unsigned i = 0; i < readers_.size(); i++) delete readers_[i]; 
+  }
+
+  int EventPipeline::run(int first, int last) 
+  {
+    //ROOT object creation is not something we want to do from the workers 
+    while ((int) readers_.size() < nthreads_) readers_.push_back(factory_()); 
+
+    if (last < 0 || last >= readers_[0]->nEvents()) last = readers_[0]->nEvents()-1; 
+
+    next_entry_ = first; 
+    last_entry_ = last; 
+    next_output_ = first; 
+    in_flight_ = 0; 
+    nprocessed_ = 0; 
+
+    if (nthreads_ == 1) 
+    {
+      work(0); 
+      return nprocessed_; 
+    }
+
+    std::vector<std::thread> threads; 
+    for (int i = 0; i < nthreads_; i++) threads.push_back(std::thread(&EventPipeline::work, this, i)); 
+    for (int i = 0; i < nthreads_; i++) threads[i].join(); 
+
+    return nprocessed_; 
+  }
+
+
+  void EventPipeline::work(int worker) 
+  {
+    Reader * r = readers_[worker]; 
+
+    while (true) 
+    {
+      int entry; 
+
+      {
+        std::unique_lock<std::mutex> l(m_); 
+        cv_.wait(l, [this] { return next_entry_ > last_entry_ || in_flight_ < max_in_flight_; }); 
+        if (next_entry_ > last_entry_) return; 
+        entry = next_entry_++; 
+        in_flight_++; 
+      }
+
+      //an entry that can't be loaded counts as not kept, rather than running the stages on whatever the reader had before 
+      bool keep = r->get(entry) == entry; 
+      Event & ev = r->event(); 
+      if (!keep || !r->eventLoaded()) 
+      {
+        log::out(log::LOG_WARN, "EventPipeline: could not load entry %d, skipping it\n", entry); 
+        keep = false; 
+      }
+
+      for (unsigned i = 0; keep && i < stages_.size(); i++) 
+      {
+        if (!stages_[i](ev, entry, worker))
+        {
+          keep = false; 
+          break; 
+        }
+      }
+
+      if (ordered_) 
+      {
+        //wait for our turn. Since entries are handed out in order, the oldest one in flight can always proceed 
+        {
+          std::unique_lock<std::mutex> l(m_); 
+          cv_.wait(l, [this,entry] { return next_output_ == entry; }); 
+        }
+        if (keep && output_) output_(ev, entry); 
+      }
+      else if (keep && output_) 
+      {
+        std::lock_guard<std::mutex> l(output_m_); 
+        output_(ev, entry); 
+      }
+
+      {
+        std::lock_guard<std::mutex> l(m_); 
+        if (ordered_) next_output_++; 
+        in_flight_--; 
+        if (keep) nprocessed_++; 
+      }
+      cv_.notify_all(); 
+    }
+  }
+}
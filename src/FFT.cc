@@ -2,76 +2,469 @@
 #include <fftw3.h> 
 #include "TMutex.h" 
 #include <map> 
+#include <list>
+#include <memory>
+#include <chrono>
+#include <string.h> 
+#include <stdio.h> 
 
 
 static const char * wisdom = nullptr; 
-static TMutex fftw_lock; 
+//not a std::string, since it is used from on_exit, after static destructors have run
+static char wisdom_single[4096]; 
+static TMutex fftw_lock; //the FFTW planners are not thread-safe
+static TMutex cache_lock; //protects the plan caches and their statistics
 
-static const int NALIGN = 8; 
+static const int NALIGN = 16; 
 
-struct fft_setup
+
+/* Maps the double and single precision FFTW interfaces onto the same names */ 
+template <typename T> struct fftw_traits; 
+
+template <> struct fftw_traits<double>
+{
+  typedef fftw_plan plan; 
+  typedef fftw_complex complex; 
+  static plan r2c(int N, double * y, complex * Y, unsigned flags) { return fftw_plan_dft_r2c_1d(N,y,Y,flags); } 
+  static plan c2r(int N, complex * Y, double * y, unsigned flags) { return fftw_plan_dft_c2r_1d(N,Y,y,flags); } 
+  static plan r2c_many(int N, int howmany, double * y, complex * Y, unsigned flags) 
+  {
+    return fftw_plan_many_dft_r2c(1, &N, howmany, y, 0, 1, N, Y, 0, 1, N/2+1, flags); 
+  }
+  static plan c2r_many(int N, int howmany, complex * Y, double * y, unsigned flags) 
+  {
+    return fftw_plan_many_dft_c2r(1, &N, howmany, Y, 0, 1, N/2+1, y, 0, 1, N, flags); 
+  }
+  static void execute_r2c(const plan p, double * y, complex * Y) { fftw_execute_dft_r2c(p,y,Y); } 
+  static void execute_c2r(const plan p, complex * Y, double * y) { fftw_execute_dft_c2r(p,Y,y); } 
+  static void destroy(plan p) { fftw_destroy_plan(p); } 
+  static void * malloc(size_t n) { return fftw_malloc(n); } 
+  static void free(void * p) { fftw_free(p); } 
+  static int alignment_of(const void * p) { return fftw_alignment_of((double*) p); } 
+}; 
+
+template <> struct fftw_traits<float>
 {
-  fft_setup(size_t n) 
+  typedef fftwf_plan plan; 
+  typedef fftwf_complex complex; 
+  static plan r2c(int N, float * y, complex * Y, unsigned flags) { return fftwf_plan_dft_r2c_1d(N,y,Y,flags); } 
+  static plan c2r(int N, complex * Y, float * y, unsigned flags) { return fftwf_plan_dft_c2r_1d(N,Y,y,flags); } 
+  static plan r2c_many(int N, int howmany, float * y, complex * Y, unsigned flags) 
+  {
+    return fftwf_plan_many_dft_r2c(1, &N, howmany, y, 0, 1, N, Y, 0, 1, N/2+1, flags); 
+  }
+  static plan c2r_many(int N, int howmany, complex * Y, float * y, unsigned flags) 
   {
+    return fftwf_plan_many_dft_c2r(1, &N, howmany, Y, 0, 1, N/2+1, y, 0, 1, N, flags); 
+  }
+  static void execute_r2c(const plan p, float * y, complex * Y) { fftwf_execute_dft_r2c(p,y,Y); } 
+  static void execute_c2r(const plan p, complex * Y, float * y) { fftwf_execute_dft_c2r(p,Y,y); } 
+  static void destroy(plan p) { fftwf_destroy_plan(p); } 
+  static void * malloc(size_t n) { return fftwf_malloc(n); } 
+  static void free(void * p) { fftwf_free(p); } 
+  static int alignment_of(const void * p) { return fftwf_alignment_of((float*) p); } 
+}; 
+
+
+/* Layout of the buffers for howmany transforms of length N. The time-domain
+ * transforms are packed N apart, the frequency-domain ones N/2+1 apart, and the
+ * frequency domain starts at the next aligned position after the time domain. */ 
+static inline size_t time_size(size_t N, size_t howmany) { return ((N * howmany + NALIGN - 1) / NALIGN) * NALIGN; } 
 
-    N  = n;
-    mem = fftw_malloc(sizeof(double) * (N + N % NALIGN) + (N/2 + 1) * sizeof(fftw_complex)); 
-    y = (double *) mem; 
-    Y = (fftw_complex *) (y + N + N % NALIGN); 
+template <typename T>
+static inline size_t buffer_size(size_t N, size_t howmany) 
+{
+  return sizeof(T) * time_size(N,howmany) + howmany * (N/2 + 1) * sizeof(typename fftw_traits<T>::complex); 
+}
+
+
+/* Plans for howmany transforms of length N.
+ *
+ * Plans are shared between all threads (fftw_execute_dft_* is thread-safe),
+ * and are always executed with new-array execution, on either the caller's
+ * arrays or on per-thread scratch buffers. */ 
+template <typename T>
+struct fft_plans
+{
+  typedef fftw_traits<T> F; 
 
+  fft_plans(size_t n, size_t nmany) 
+    : N(n), howmany(nmany) 
+  {
+    // Plan with temporary buffers of the same layout (and alignment) as the scratch buffers.
+    // The forward transform may be executed directly on the caller's input (see forward()), so it must preserve it. 
+    void * mem = F::malloc(buffer_size<T>(N,howmany)); 
+    T * y = (T *) mem; 
+    typename F::complex * Y = (typename F::complex *) (y + time_size(N,howmany)); 
+
+    if (howmany == 1) 
+    {
+      forward = F::r2c(N, y, Y,FFTW_MEASURE | FFTW_PRESERVE_INPUT); 
+      inverse = F::c2r(N, Y, y,FFTW_MEASURE | FFTW_DESTROY_INPUT); 
+    }
+    else
+    {
+      forward = F::r2c_many(N, howmany, y, Y, FFTW_MEASURE | FFTW_PRESERVE_INPUT); 
+      inverse = F::c2r_many(N, howmany, Y, y, FFTW_MEASURE | FFTW_DESTROY_INPUT); 
+    }
+
+    F::free(mem); 
+  }
+
+  ~fft_plans() 
+  {
     TLockGuard l(&fftw_lock); 
-    forward = fftw_plan_dft_r2c_1d(N, y, Y,FFTW_MEASURE | FFTW_DESTROY_INPUT); 
-    inverse = fftw_plan_dft_c2r_1d(N, Y, y,FFTW_MEASURE | FFTW_DESTROY_INPUT); 
+    F::destroy(forward); 
+    F::destroy(inverse); 
   }
 
   size_t N; 
-  fftw_plan forward; 
-  fftw_plan inverse; 
+  size_t howmany; 
+  typename F::plan forward; 
+  typename F::plan inverse; 
+}; 
+
+typedef std::pair<size_t,size_t> plan_key; 
+
+/* LRU plan cache (one per precision). The most recently used plans are at the front of the list.
+ * Evicted plans survive until the last thread using them is done with them.
+ **/ 
+template <typename T>
+struct plan_cache
+{
+  typedef std::shared_ptr<fft_plans<T> > plan_ptr; 
+  typedef std::list<std::pair<plan_key, plan_ptr> > list_t; 
+
+  list_t lru; 
+  std::map<plan_key, typename list_t::iterator> index; 
+  nurfana::fft::CacheStats stats; 
+
+  static plan_cache & instance() { static plan_cache c; return c; } 
+
+  /* Looks up a plan (moving it to the front of the LRU list), returning null if not there. Must hold cache_lock. */ 
+  plan_ptr lookup(const plan_key & key) 
+  {
+    auto it = index.find(key); 
+    if (it == index.end()) return plan_ptr(); 
+    lru.splice(lru.begin(), lru, it->second); 
+    return it->second->second; 
+  }
+
+  /* Evicts down to capacity, moving the evicted plans to evicted so they can be destroyed without holding cache_lock */ 
+  void shrink(size_t capacity, std::vector<plan_ptr> & evicted) 
+  {
+    while (lru.size() > capacity) 
+    {
+      evicted.push_back(lru.back().second); 
+      index.erase(lru.back().first); 
+      lru.pop_back(); 
+      stats.evictions++; 
+    }
+    stats.nplans = lru.size(); 
+  }
+}; 
+
+static size_t cache_capacity = 64; 
+
+
+template <typename T>
+static typename plan_cache<T>::plan_ptr plans(size_t N, size_t howmany = 1) 
+{
+  typedef typename plan_cache<T>::plan_ptr plan_ptr; 
+  plan_cache<T> & c = plan_cache<T>::instance(); 
+  plan_key key(N,howmany); 
+
+  {
+    TLockGuard l(&cache_lock); 
+    plan_ptr p = c.lookup(key); 
+    if (p) 
+    {
+      c.stats.hits++; 
+      return p; 
+    }
+  }
+
+  std::vector<plan_ptr> evicted; //destroyed once we've released the locks
+  plan_ptr p; 
+  {
+    TLockGuard l(&fftw_lock); 
+
+    //someone else may have planned this while we were waiting
+    {
+      TLockGuard lc(&cache_lock); 
+      p = c.lookup(key); 
+      if (p) 
+      {
+        c.stats.hits++; 
+        return p; 
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now(); 
+    p = std::make_shared<fft_plans<T> >(N,howmany); 
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start; 
+
+    TLockGuard lc(&cache_lock); 
+    c.stats.misses++; 
+    c.stats.planning_time += elapsed.count(); 
+    c.lru.push_front(std::make_pair(key,p)); 
+    c.index[key] = c.lru.begin(); 
+    if (cache_capacity) c.shrink(cache_capacity, evicted); 
+    c.stats.nplans = c.lru.size(); 
+  }
+
+  return p; 
+}
+
+/* Per-thread scratch buffers, used when the caller's arrays are not aligned
+ * or not laid out like the plan. These only ever grow. */ 
+template <typename T>
+struct fft_scratch
+{
+  typedef fftw_traits<T> F; 
+  fft_scratch() : mem(0), nbytes(0) { ; } 
+  ~fft_scratch() { if (mem) F::free(mem); } 
+
+  void get(size_t N, size_t howmany, T ** y, typename F::complex ** Y) 
+  {
+    size_t need = buffer_size<T>(N,howmany); 
+    if (need > nbytes) 
+    {
+      if (mem) F::free(mem); 
+      mem = F::malloc(need); 
+      nbytes = need; 
+    }
+    *y = (T*) mem; 
+    *Y = (typename F::complex *) (*y + time_size(N,howmany)); 
+  }
+
+  static fft_scratch & local() { static thread_local fft_scratch s; return s; } 
+
   void * mem; 
-  double * y; 
-  fftw_complex * Y; 
+  size_t nbytes; 
 }; 
 
-static thread_local std::map<size_t, fft_setup * > setups; 
 
 __attribute__((destructor)) 
 static void on_exit() 
 {
-  if (wisdom) fftw_export_wisdom_to_filename(wisdom); 
+  if (wisdom) 
+  {
+    fftw_export_wisdom_to_filename(wisdom); 
+    if (*wisdom_single) fftwf_export_wisdom_to_filename(wisdom_single); 
+  }
+}
+
+/* The buffers the plans are made with are maximally aligned, so new-array execution
+ * is allowed on anything else that is as well */ 
+template <typename T>
+static inline bool aligned(const void * p) 
+{
+  return fftw_traits<T>::alignment_of(p) == 0; 
 }
 
-static fft_setup & setup(size_t N) 
+
+template <typename T>
+static void do_forward(size_t N, size_t howmany, size_t stride, const T * y, std::complex<T> *Y, size_t fstride) 
 {
-  if (setups.count(N)) return *setups[N]; 
-  setups[N] = new fft_setup(N); 
-  return *setups[N]; 
+  typedef fftw_traits<T> F; 
+  typedef typename F::complex C; 
+  size_t nf = N/2+1; 
+  if (!stride) stride = N; 
+  if (!fstride) fstride = nf; 
+
+  typename plan_cache<T>::plan_ptr p = plans<T>(N, howmany); 
+
+  if ((howmany == 1 || (stride == N && fstride == nf)) && aligned<T>(y) && aligned<T>(Y)) 
+  {
+    F::execute_r2c(p->forward, (T*) y, (C*) Y); 
+    return; 
+  }
+
+  T * sy; 
+  C * sY; 
+  fft_scratch<T>::local().get(N,howmany,&sy,&sY); 
+
+  if (stride == N) 
+  {
+    memcpy(sy, y, howmany * N * sizeof(T)); 
+  }
+  else
+  {
+    for (size_t i = 0; i < howmany; i++) memcpy(sy + i * N, y + i * stride, N * sizeof(T)); 
+  }
+
+  F::execute_r2c(p->forward, sy, sY); 
+
+  if (fstride == nf) 
+  {
+    memcpy((void*) Y, sY, howmany * nf * sizeof(C)); 
+  }
+  else
+  {
+    for (size_t i = 0; i < howmany; i++) memcpy((void*) (Y + i * fstride), sY + i * nf, nf * sizeof(C)); 
+  }
+}
+
+template <typename T>
+static void do_inverse(size_t N, size_t howmany, size_t stride, const std::complex<T> * Y, T * y, size_t fstride) 
+{
+  typedef fftw_traits<T> F; 
+  typedef typename F::complex C; 
+  size_t nf = N/2+1; 
+  if (!stride) stride = N; 
+  if (!fstride) fstride = nf; 
+
+  typename plan_cache<T>::plan_ptr p = plans<T>(N, howmany); 
+
+  T * sy; 
+  C * sY; 
+  fft_scratch<T>::local().get(N,howmany,&sy,&sY); 
+
+  if (fstride == nf) 
+  {
+    memcpy(sY, Y, howmany * nf * sizeof(C)); 
+  }
+  else
+  {
+    for (size_t i = 0; i < howmany; i++) memcpy(sY + i * nf, Y + i * fstride, nf * sizeof(C)); 
+  }
+
+  if ((howmany == 1 || stride == N) && aligned<T>(y)) 
+  {
+    F::execute_c2r(p->inverse, sY, y); 
+    return; 
+  }
+
+  F::execute_c2r(p->inverse, sY, sy); 
+
+  if (stride == N) 
+  {
+    memcpy(y, sy, howmany * N * sizeof(T)); 
+  }
+  else
+  {
+    for (size_t i = 0; i < howmany; i++) memcpy(y + i * stride, sy + i * N, N * sizeof(T)); 
+  }
 }
 
 namespace nurfana
 {
   namespace fft
   {
+    void * allocAligned(size_t nbytes) 
+    {
+      return fftw_malloc(nbytes); 
+    }
+
+    void freeAligned(void * ptr) 
+    {
+      fftw_free(ptr); 
+    }
+
     void setWisdomFile(const char * f) 
-    { 
+    {
       wisdom = f; 
+      if (snprintf(wisdom_single, sizeof(wisdom_single), "%s.single", f) >= (int) sizeof(wisdom_single)) 
+      {
+        wisdom_single[0] = 0; 
+      }
+      TLockGuard l(&fftw_lock); 
       fftw_import_wisdom_from_filename(f); 
+      if (*wisdom_single) fftwf_import_wisdom_from_filename(wisdom_single); 
+    }
+
+    void prepare(size_t nsizes, const size_t * sizes, size_t howmany, bool single_precision) 
+    {
+      for (size_t i = 0; i < nsizes; i++) 
+      {
+        if (single_precision) plans<float>(sizes[i], howmany); 
+        else plans<double>(sizes[i], howmany); 
+      }
+    }
+
+    void setCacheCapacity(size_t max_plans) 
+    {
+      std::vector<plan_cache<double>::plan_ptr> evicted; 
+      std::vector<plan_cache<float>::plan_ptr> evictedf; 
+      TLockGuard l(&cache_lock); 
+      cache_capacity = max_plans; 
+      if (!cache_capacity) return; 
+      plan_cache<double>::instance().shrink(cache_capacity, evicted); 
+      plan_cache<float>::instance().shrink(cache_capacity, evictedf); 
+    }
+
+    void clearCache() 
+    {
+      std::vector<plan_cache<double>::plan_ptr> evicted; 
+      std::vector<plan_cache<float>::plan_ptr> evictedf; 
+      TLockGuard l(&cache_lock); 
+      plan_cache<double>::instance().shrink(0, evicted); 
+      plan_cache<float>::instance().shrink(0, evictedf); 
+    }
+
+    CacheStats cacheStats() 
+    {
+      TLockGuard l(&cache_lock); 
+      CacheStats s = plan_cache<double>::instance().stats; 
+      const CacheStats & sf = plan_cache<float>::instance().stats; 
+      s.hits += sf.hits; 
+      s.misses += sf.misses; 
+      s.evictions += sf.evictions; 
+      s.nplans += sf.nplans; 
+      s.planning_time += sf.planning_time; 
+      return s; 
+    }
+
+    void resetCacheStats() 
+    {
+      TLockGuard l(&cache_lock); 
+      CacheStats & s = plan_cache<double>::instance().stats; 
+      s = CacheStats(); 
+      s.nplans = plan_cache<double>::instance().lru.size(); 
+      CacheStats & sf = plan_cache<float>::instance().stats; 
+      sf = CacheStats(); 
+      sf.nplans = plan_cache<float>::instance().lru.size(); 
     }
 
     void forward(size_t N, const double * y, std::complex<double> *Y) 
     {
-      fft_setup & s = setup(N); 
-      memcpy(s.y, y, N * sizeof(double)); 
-      fftw_execute(s.forward); 
-      memcpy(Y, s.Y, (N/2 + 1) * sizeof(fftw_complex)); 
+      do_forward<double>(N,1,N,y,Y,N/2+1); 
     }
 
     void inverse(size_t N, const std::complex<double> * Y, double * y) 
     {
-      fft_setup & s = setup(N); 
-      memcpy(s.Y, Y, (N/2 + 1) * sizeof(fftw_complex)); 
-      fftw_execute(s.inverse); 
-      memcpy(y, s.y, N * sizeof(double)); 
+      do_inverse<double>(N,1,N,Y,y,N/2+1); 
+    }
+
+    void forwardMany(size_t N, size_t howmany, size_t stride, const double * y, std::complex<double> *Y, size_t fstride) 
+    {
+      do_forward<double>(N,howmany,stride,y,Y,fstride); 
+    }
+
+    void inverseMany(size_t N, size_t howmany, size_t stride, const std::complex<double> * Y, double * y, size_t fstride) 
+    {
+      do_inverse<double>(N,howmany,stride,Y,y,fstride); 
+    }
+
+    void forward(size_t N, const float * y, std::complex<float> *Y) 
+    {
+      do_forward<float>(N,1,N,y,Y,N/2+1); 
+    }
+
+    void inverse(size_t N, const std::complex<float> * Y, float * y) 
+    {
+      do_inverse<float>(N,1,N,Y,y,N/2+1); 
+    }
+
+    void forwardMany(size_t N, size_t howmany, size_t stride, const float * y, std::complex<float> *Y, size_t fstride) 
+    {
+      do_forward<float>(N,howmany,stride,y,Y,fstride); 
+    }
+
+    void inverseMany(size_t N, size_t howmany, size_t stride, const std::complex<float> * Y, float * y, size_t fstride) 
+    {
+      do_inverse<float>(N,howmany,stride,Y,y,fstride); 
     }
   }
 }
-
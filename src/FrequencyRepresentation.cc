@@ -33,7 +33,9 @@ namespace nurfana
     TAttMarker::operator=(other); 
     Nt_ = other.Nt(); 
     t0_ = other.t0(); 
-    Y_.insert(Y_.begin(), other.Y(), other.Y() + other.Nf()); 
+    df_ = other.df(); 
+    Y_.assign(other.Y(), other.Y() + other.Nf()); 
+    invalidate(); 
     return *this; 
   }
 
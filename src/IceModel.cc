@@ -1,5 +1,6 @@
 #include "nurfana/IceModel.h" 
 #include "nurfana_private.h" 
+#include "nurfana_simd.h" 
 #include "TGraph.h" 
 #include "TAxis.h" 
 
@@ -49,14 +50,14 @@ namespace nurfana
       TGraph * g = new TGraph(N); 
       TString str; 
 
+      if (what != ATTZ) 
+      {
+        for (int i = 0; i < N; i++) g->GetX()[i] = minz + (maxz-minz)/(N-1) * i; 
+      }
+
       if (what == ATTF) 
       {
-        for (int i = 0; i < N; i++) 
-        {
-          double z =  (maxz-minz)/(N-1) * i; 
-          g->GetX()[i] =z; 
-          g->GetY()[i] = attenuation_.attenuation(z,attf); 
-        }
+        attenuation_.attenuationMany(N, g->GetX(), g->GetY(), attf); 
         g->GetXaxis()->SetTitle("Depth (m)"); 
         g->GetYaxis()->SetTitle("Attenuation (m) "); 
         str.Form("Attenuation vs. Depth (f=%g GHz)", attf); 
@@ -67,7 +68,7 @@ namespace nurfana
       {
         for (int i = 0; i < N; i++) 
         {
-          double f = (maxf - minf) / (N-1) * i; 
+          double f = minf + (maxf - minf) / (N-1) * i; 
           g->GetX()[i] = f; 
           g->GetY()[i] = attenuation_.attenuation(attz,f); 
         }
@@ -79,12 +80,7 @@ namespace nurfana
 
       if (what == REF) 
       {
-        for (int i = 0; i < N; i++) 
-        {
-          double z =  (maxz-minz)/(N-1) * i; 
-          g->GetX()[i] =z; 
-          g->GetY()[i] = refraction_.n(z); 
-        }
+        refraction_.nMany(N, g->GetX(), g->GetY()); 
        
         g->GetXaxis()->SetTitle("Depth (m)"); 
         g->GetYaxis()->SetTitle("Refractive Index"); 
@@ -94,12 +90,7 @@ namespace nurfana
 
       if (what == RHO) 
       {
-        for (int i = 0; i < N; i++) 
-        {
-          double z =  (maxz-minz)/(N-1) * i; 
-          g->GetX()[i] =z; 
-          g->GetY()[i] = density_.density(z); 
-        }
+        density_.densityMany(N, g->GetX(), g->GetY()); 
        
         g->GetXaxis()->SetTitle("Depth (m)"); 
         g->GetYaxis()->SetTitle("Density (g/cm^{3})"); 
@@ -118,12 +109,253 @@ namespace nurfana
        return 1; 
     }
 
+    void ExponentialRefractionModel::nMany(size_t N, const double * z_m, double * out) const 
+    {
+      simd::affine_exp(N, z_m, out, a0_ + a1_, -a1_, -b1_); 
+    }
+
+    void ExponentialDensityModel::densityMany(size_t N, const double * z_m, double * out) const 
+    {
+      simd::affine_exp(N, z_m, out, a0_ + a1_, -a1_, -b1_); 
+    }
+
     int ExponentialDensityModel::getDepthsWithDensity(double rho, std::vector<double> & depths) const
     {
        if (rho < density(0) || rho > density(10000)) return 0; 
        depths.push_back(-log(1-(rho-a0_)/a1_)/b1_); 
        return 1; 
     }
+
+
+    /* Fritsch-Carlson: limits the Hermite slopes so each interval stays monotone. delta are the secant slopes, m the node slopes, in the same units */ 
+    static void limit_slopes(int n, const double * delta, double * m) 
+    {
+      for (int i = 0; i < n-1; i++) 
+      {
+        if (delta[i] == 0) 
+        {
+          m[i] = 0; 
+          m[i+1] = 0; 
+          continue; 
+        }
+        double a = m[i] / delta[i]; 
+        double b = m[i+1] / delta[i]; 
+        if (a < 0) { m[i] = 0; a = 0; } 
+        if (b < 0) { m[i+1] = 0; b = 0; } 
+        double r2 = a*a + b*b; 
+        if (r2 > 9) 
+        {
+          double tau = 3 / sqrt(r2); 
+          m[i] = tau * a * delta[i]; 
+          m[i+1] = tau * b * delta[i]; 
+        }
+      }
+    }
+
+    static void initial_slopes(int n, const double * delta, double * m) 
+    {
+      // three-point differences at the ends, where possible, unless they have the wrong sign 
+      m[0] = n > 2 ? 1.5 * delta[0] - 0.5 * delta[1] : delta[0]; 
+      m[n-1] = n > 2 ? 1.5 * delta[n-2] - 0.5 * delta[n-3] : delta[n-2]; 
+      if (m[0] * delta[0] < 0) m[0] = 0; 
+      if (m[n-1] * delta[n-2] < 0) m[n-1] = 0; 
+      for (int i = 1; i < n-1; i++) 
+      {
+        m[i] = delta[i-1] * delta[i] <= 0 ? 0 : 0.5 * (delta[i-1] + delta[i]); 
+      }
+    }
+
+    void TabulatedProfile::setUniform(int N, double xmin, double xmax, const double * y) 
+    {
+      x0_ = xmin; 
+      dx_ = (xmax - xmin) / (N-1); 
+      inv_dx_ = 1./dx_; 
+      y_.assign(y, y + N); 
+      init(); 
+    }
+
+    void TabulatedProfile::setPoints(int n, const double * x, const double * y, int N) 
+    {
+      // interpolate the measurements the same way, but on their own spacing 
+      std::vector<double> delta(n-1); 
+      std::vector<double> m(n); 
+      for (int i = 0; i < n-1; i++) delta[i] = (y[i+1] - y[i]) / (x[i+1] - x[i]); 
+      initial_slopes(n, &delta[0], &m[0]); 
+      limit_slopes(n, &delta[0], &m[0]); 
+
+      x0_ = x[0]; 
+      dx_ = (x[n-1] - x[0]) / (N-1); 
+      inv_dx_ = 1./dx_; 
+      y_.resize(N); 
+
+      int k = 0; 
+      for (int i = 0; i < N; i++) 
+      {
+        double xi = i == N-1 ? x[n-1] : x0_ + i * dx_; 
+        while (k < n-2 && x[k+1] < xi) k++; 
+        double h = x[k+1] - x[k]; 
+        double s = (xi - x[k]) / h; 
+        double s1 = 1 - s; 
+        y_[i] = (1 + 2*s) * s1 * s1 * y[k] + s * s1 * s1 * h * m[k] + s * s * (3 - 2*s) * y[k+1] - s * s * s1 * h * m[k+1]; 
+      }
+
+      init(); 
+    }
+
+    void TabulatedProfile::init() 
+    {
+      int N = y_.size(); 
+      std::vector<double> delta(N-1); 
+      bool up = true; 
+      bool down = true; 
+      for (int i = 0; i < N-1; i++) 
+      {
+        delta[i] = y_[i+1] - y_[i]; 
+        if (delta[i] < 0) up = false; 
+        if (delta[i] > 0) down = false; 
+      }
+
+      m_.resize(N); 
+      initial_slopes(N, &delta[0], &m_[0]); 
+      limit_slopes(N, &delta[0], &m_[0]); 
+
+      monotone_ = up && !down ? 1 : down && !up ? -1 : 0; 
+      inv_.clear(); 
+      if (!monotone_) return; 
+
+      // in terms of g = monotone_ * y, which always increases 
+      double g0 = monotone_ * y_[0]; 
+      double g1 = monotone_ * y_[N-1]; 
+      inv_y0_ = g0; 
+      inv_scale_ = (N-1) / (g1 - g0); 
+      inv_.resize(N); 
+      int i = 0; 
+      for (int k = 0; k < N; k++) 
+      {
+        double g = g0 + k / inv_scale_; 
+        while (i < N-2 && monotone_ * y_[i+1] < g) i++; 
+        inv_[k] = i; 
+      }
+    }
+
+    double TabulatedProfile::solveSegment(int i, double y) const 
+    {
+      // the interval is monotone, so bracketed Newton in s converges 
+      double lo = 0, hi = 1; 
+      double sign = y_[i+1] >= y_[i] ? 1 : -1; 
+      double s = y_[i+1] == y_[i] ? 0 : (y - y_[i]) / (y_[i+1] - y_[i]); 
+      for (int iter = 0; iter < 100; iter++) 
+      {
+        double s1 = 1 - s; 
+        double f = (1 + 2*s) * s1 * s1 * y_[i] + s * s1 * s1 * m_[i] + s * s * (3 - 2*s) * y_[i+1] - s * s * s1 * m_[i+1] - y; 
+        if (f == 0) break; 
+        if (sign * f < 0) lo = s; 
+        else hi = s; 
+        double fp = 6 * s * s1 * (y_[i+1] - y_[i]) + (1 - 4*s + 3*s*s) * m_[i] + (3*s*s - 2*s) * m_[i+1]; 
+        double next = fp != 0 ? s - f / fp : -1; 
+        if (!(next > lo && next < hi)) next = 0.5 * (lo + hi); 
+        if (fabs(next - s) < 1e-15) { s = next; break; } 
+        s = next; 
+      }
+      return x0_ + (i + s) * dx_; 
+    }
+
+    int TabulatedProfile::findX(double y, std::vector<double> & xs) const 
+    {
+      int N = y_.size(); 
+      if (N < 2) return 0; 
+
+      if (monotone_) 
+      {
+        double g = monotone_ * y; 
+        if (g < monotone_ * y_[0] || g > monotone_ * y_[N-1]) return 0; 
+        int k = (int) ((g - inv_y0_) * inv_scale_); 
+        if (k < 0) k = 0; 
+        if (k > N-1) k = N-1; 
+        int i = inv_[k]; 
+        while (i < N-2 && monotone_ * y_[i+1] < g) i++; 
+        xs.push_back(solveSegment(i, y)); 
+        return 1; 
+      }
+
+      int found = 0; 
+      for (int i = 0; i < N-1; i++) 
+      {
+        if ((y - y_[i]) * (y - y_[i+1]) > 0) continue; 
+        // a node shared by two intervals only counts once 
+        if (i > 0 && y == y_[i] && (y - y_[i-1]) * (y - y_[i]) <= 0) continue; 
+        xs.push_back(solveSegment(i, y)); 
+        found++; 
+      }
+      return found; 
+    }
+
+
+    TabulatedRefractionModel::TabulatedRefractionModel(const RefractionModel & m, double zmax, int npoints) 
+    {
+      std::vector<double> z(npoints); 
+      std::vector<double> n(npoints); 
+      for (int i = 0; i < npoints; i++) z[i] = i * zmax / (npoints-1); 
+      m.nMany(npoints, &z[0], &n[0]); 
+      t_.setUniform(npoints, 0, zmax, &n[0]); 
+    }
+
+    TabulatedRefractionModel::TabulatedRefractionModel(int N, const double * z, const double * n, int npoints) 
+    {
+      t_.setPoints(N, z, n, npoints); 
+    }
+
+
+    TabulatedAttenuationModel::TabulatedAttenuationModel(const AttenuationModel & m, double zmax, int nz, double fmin, double fmax, int nf) 
+      : fmin_(fmin), df_(nf > 1 ? (fmax - fmin) / (nf-1) : 1), t_(nf) 
+    {
+      std::vector<double> z(nz); 
+      std::vector<double> L(nz); 
+      for (int i = 0; i < nz; i++) z[i] = i * zmax / (nz-1); 
+      for (int j = 0; j < nf; j++) 
+      {
+        m.attenuationMany(nz, &z[0], &L[0], fmin + j * df_); 
+        t_[j].setUniform(nz, 0, zmax, &L[0]); 
+      }
+    }
+
+    TabulatedAttenuationModel::TabulatedAttenuationModel(int N, const double * z, const double * L, int npoints) 
+      : fmin_(0), df_(1), t_(1) 
+    {
+      t_[0].setPoints(N, z, L, npoints); 
+    }
+
+    int TabulatedAttenuationModel::bracket(double f, double * w) const 
+    {
+      int nf = t_.size(); 
+      *w = 0; 
+      if (nf == 1) return 0; 
+      double u = (f - fmin_) / df_; 
+      if (!(u > 0)) return 0; 
+      if (u >= nf-1) return nf-1; 
+      int i = (int) u; 
+      *w = u - i; 
+      return i; 
+    }
+
+    double TabulatedAttenuationModel::attenuation(double z_m, double f_GHz) const 
+    {
+      double w; 
+      int i = bracket(f_GHz, &w); 
+      double L = t_[i].eval(z_m); 
+      return w > 0 ? (1-w) * L + w * t_[i+1].eval(z_m) : L; 
+    }
+
+    void TabulatedAttenuationModel::attenuationMany(size_t N, const double * z_m, double * out, double f_GHz) const 
+    {
+      double w; 
+      int i = bracket(f_GHz, &w); 
+      t_[i].evalMany(N, z_m, out); 
+      if (w > 0) 
+      {
+        for (size_t k = 0; k < N; k++) out[k] = (1-w) * out[k] + w * t_[i+1].eval(z_m[k]); 
+      }
+    }
   }
 
 }
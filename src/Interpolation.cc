@@ -3,7 +3,11 @@
 
 #include "nurfana/Interpolation.h" 
 #include "nurfana/TimeRepresentation.h" 
+#include "nurfana/Logging.h" 
+#include "nurfana_simd.h" 
 #include <algorithm> 
+#include <list> 
+#include <cmath> 
 
 static TMutex setter; 
 
@@ -11,7 +15,19 @@ namespace nurfana
 {
 
   static InterpolationType default_interpolation; 
-  static void * default_opt; 
+  static const void * default_opt; 
+
+  /* Interpolators build what they need from their input on first use, and it is read-only after that. 
+   * Threads that race to build it all do, but only the first one's is kept, so readers never lock. 
+   * setInput (which must not race evaluation) throws it away. */ 
+  template <typename T> 
+  static T * publish(T ** slot, T * made, void (*destroy)(T *)) 
+  {
+    T * expected = 0; 
+    if (__atomic_compare_exchange_n(slot, &expected, made, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return made; 
+    destroy(made); 
+    return expected; 
+  }
 
   Interpolator * Interpolator::make(InterpolationType t, const void * opt) 
   {
@@ -19,18 +35,25 @@ namespace nurfana
     switch(t)
     {
       case kInterpDefault: 
-        t = default_interpolation;
-        opt = default_opt; 
+        {
+          TLockGuard l(&setter); 
+          t = default_interpolation;
+          opt = default_opt; 
+        }
+        if (t == kInterpDefault) return new GSLInterpolator; 
+        return make(t, opt); 
       case kInterpGSL: 
-        return new GSLInterpolator;
+        return new GSLInterpolator((const gsl_interp_type *) opt);
       case kInterpLinear:
         return new LinearInterpolator;
+      case kInterpSinc:
+        return new SincInterpolator((const SincInterpolator::Options *) opt);
       default: 
         return make(kInterpDefault,opt); 
     }
   }
 
-  void setDefaultInterpolator(InterpolationType t, void * opt)
+  void Interpolator::setDefaultInterpolator(InterpolationType t, const void * opt)
   {
     TLockGuard l(&setter); //make sure these are set atomically 
     default_interpolation = t; 
@@ -40,14 +63,53 @@ namespace nurfana
 
   void Interpolator::eval(TimeRepresentation * out) const
   { 
-    evalMany (out->N(), out->t(), out->updateY(),true);
+    if (const EvenRepresentation * even = dynamic_cast<const EvenRepresentation *>(out)) 
+      evalEven(out->N(), even->t0(), even->dt(), out->updateY()); 
+    else
+      evalMany (out->N(), out->t(), out->updateY(),true);
   } 
 
+  double * Interpolator::evalEven(size_t N, double t0, double dt, double * y) const
+  {
+    std::vector<double> t(N); 
+    for (size_t i = 0; i < N; i++) t[i] = t0 + i * dt; 
+    if (!y) y = new double[N]; 
+    return N ? evalMany(N, &t[0], y, true) : y; 
+  }
+
   double * LinearInterpolator::evalMany(size_t N, const double * t, double * y, bool sorted) const
   {
     if (!y) y = new double[N]; 
 
+    size_t n = input_ ? input_->N() : 0; 
+    if (n < 2) 
+    {
+      for (size_t i = 0; i < N; i++) y[i] = n ? input_->y(0) : 0; 
+      return y; 
+    }
+
+    const double * in_y = input_->y(); 
 
+    //no search needed for even input: each output finds its own sample 
+    if (const EvenRepresentation * even = dynamic_cast<const EvenRepresentation *>(input_)) 
+    {
+      double t0 = even->t0(); 
+      double inv_dt = 1. / even->dt(); 
+      const double xmax = n - 1; 
+      const double kmax = n - 2; 
+      for (size_t i = 0; i < N; i++) 
+      {
+        double x = (t[i] - t0) * inv_dt; 
+        x = !(x > 0) ? 0 : x < xmax ? x : xmax; 
+        double kd = floor(x); 
+        kd = kd < kmax ? kd : kmax; 
+        size_t k = (size_t) kd; 
+        y[i] = in_y[k] + (x - kd) * (in_y[k+1] - in_y[k]); 
+      }
+      return y; 
+    }
+
+    const double * in_t = input_->t(); 
     size_t last_bound = 0; 
     for (size_t i = 0; i < N; i++) 
     {
@@ -55,16 +117,16 @@ namespace nurfana
 
       if (lower_bound == 0) 
       {
-        y[i] = input_->y(0); 
+        y[i] = in_y[0]; 
       }
-      else if (lower_bound == input_->N()) 
+      else if (lower_bound == n) 
       {
-        y[i] = input_->y(input_->N()-1);
+        y[i] = in_y[n-1];
       }
       else
       {
-        double t0 = t[i] - input_->t(lower_bound-1); 
-        y[i] = input_->y(lower_bound-1) + t0 * (input_->y(lower_bound) - input_->y(lower_bound-1)) / input_->dt(lower_bound-1); 
+        double t0 = t[i] - in_t[lower_bound-1]; 
+        y[i] = in_y[lower_bound-1] + t0 * (in_y[lower_bound] - in_y[lower_bound-1]) / (in_t[lower_bound] - in_t[lower_bound-1]); 
       }
 
       if (sorted) last_bound = lower_bound; 
@@ -73,79 +135,404 @@ namespace nurfana
     return y; 
   }
 
-  GSLInterpolator::GSLInterpolator(const gsl_interp_type * type)
+  double * LinearInterpolator::evalEven(size_t N, double t0, double dt, double * y) const
   {
-    if (!type) type = gsl_interp_akima; 
-    gsl_t_ = type; 
-    gsl_s_  = NULL;
-    gsl_a_  = NULL;
+    const EvenRepresentation * even = dynamic_cast<const EvenRepresentation *>(input_); 
+    if (!even || even->N() < 2) return Interpolator::evalEven(N, t0, dt, y); 
 
+    if (!y) y = new double[N]; 
+    simd::lerp(N, even->y(), even->N(), (t0 - even->t0()) / even->dt(), dt / even->dt(), y); 
+    return y; 
   }
 
-  GSLInterpolator::~GSLInterpolator() 
+
+  /* The polyphase table for SincInterpolator. Row p has the kernel at offsets p/L + W - 1 - j, for the 2W samples j starting W-1 before. */
+  struct sinc_table_t
+  {
+    SincInterpolator::Options opt; 
+    int W; 
+    int L; 
+    std::vector<double> k; 
+
+    const double * row(int p) const { return &k[(size_t) p * 2 * W]; } 
+
+    /* The kernel at any offset u (in samples), interpolated between phases */ 
+    double eval(double u) const
+    {
+      if (!(fabs(u) < W)) return 0; 
+      double fl = floor(u); 
+      int c = W - 1 - (int) fl; 
+      double fp = (u - fl) * L; 
+      int p = std::min((int) fp, L-1); 
+      double g = fp - p; 
+      return row(p)[c] + g * (row(p+1)[c] - row(p)[c]); 
+    }
+  }; 
+
+  static double bessel_i0(double x) 
   {
-    if (gsl_s_) 
+    double sum = 1, term = 1; 
+    for (int k = 1; k < 500; k++) 
     {
-      gsl_spline_free(gsl_s_); 
-      gsl_interp_accel_free(gsl_a_); 
+      term *= (x / (2*k)) * (x / (2*k)); 
+      sum += term; 
+      if (term < 1e-17 * sum) break; 
     }
+    return sum; 
   }
 
-  double * GSLInterpolator::evalMany(size_t N, const double * t, double *y, bool sorted) const
+  /* Tables are made once per set of options and kept forever, so interpolators (which are copied with every waveform) are cheap */ 
+  static const sinc_table_t * get_sinc_table(const SincInterpolator::Options & o) 
   {
-    if (!y) y = new double[N]; 
+    static TMutex lock; 
+    static std::list<sinc_table_t> tables; 
+
+    int W = std::max(2, (o.half_width + 1) / 2 * 2); 
+    int L = std::max(1, o.nphases); 
+
+    TLockGuard l(&lock); 
+    for (std::list<sinc_table_t>::const_iterator it = tables.begin(); it != tables.end(); it++) 
+    {
+      if (it->W == W && it->L == L && it->opt.beta == o.beta) return &(*it); 
+    }
+
+    tables.push_back(sinc_table_t()); 
+    sinc_table_t & t = tables.back(); 
+    t.opt = SincInterpolator::Options(W, o.beta, L); 
+    t.W = W; 
+    t.L = L; 
+    t.k.resize((size_t) (L+1) * 2 * W); 
 
-    double *t_sorted = 0; 
+    double norm = 1. / bessel_i0(o.beta); 
+    for (int p = 0; p <= L; p++) 
+    {
+      double * r = &t.k[(size_t) p * 2 * W]; 
+      double sum = 0; 
+      for (int j = 0; j < 2*W; j++) 
+      {
+        double u = (double) p / L + W - 1 - j; 
+        double v = 0; 
+        if (fabs(u) < W) 
+        {
+          double x = u / W; 
+          double sinc = u == 0 ? 1 : sin(M_PI * u) / (M_PI * u); 
+          v = sinc * bessel_i0(o.beta * sqrt(1 - x*x)) * norm; 
+        }
+        r[j] = v; 
+        sum += v; 
+      }
+      //unity gain at DC
+      for (int j = 0; j < 2*W; j++) r[j] /= sum; 
+    }
+
+    return &t; 
+  }
+
+  /* Evenly sampled input, at x samples from the first */ 
+  static inline double sinc_even(const sinc_table_t & tab, size_t N, const double * y, double x) 
+  {
+    if (!(x > 0)) return y[0]; 
+    if (x >= N-1) return y[N-1]; 
+
+    const int W = tab.W; 
+    double fl = floor(x); 
+    double fp = (x - fl) * tab.L; 
+    int p = std::min((int) fp, tab.L - 1); 
+    double g = fp - p; 
+    long first = (long) fl - W + 1; 
+
+    const double * r0 = tab.row(p); 
+    const double * r1 = tab.row(p+1); 
+    double d0, d1; 
+    if (first >= 0 && first + 2*W <= (long) N) 
+    {
+      simd::dot2(2*W, r0, r1, y + first, &d0, &d1); 
+    }
+    else //repeat the end samples 
+    {
+      d0 = 0; 
+      d1 = 0; 
+      for (int j = 0; j < 2*W; j++) 
+      {
+        double v = y[std::min(std::max(first + j, 0l), (long) N - 1)]; 
+        d0 += r0[j] * v; 
+        d1 += r1[j] * v; 
+      }
+    }
+    return d0 + g * (d1 - d0); 
+  }
+
+  /* Unevenly sampled input, directly. hint is a sample at or before t, if possible, and gets updated for the next call. */ 
+  static inline double sinc_uneven(const sinc_table_t & tab, size_t N, const double * tt, const double * y, double t, size_t * hint) 
+  {
+    if (!(t > tt[0])) return y[0]; 
+    if (t >= tt[N-1]) return y[N-1]; 
+
+    size_t h = *hint < N && tt[*hint] <= t ? *hint : 0; 
+    long k = std::upper_bound(tt + h, tt + N, t) - tt; //first sample after t 
+    *hint = k - 1; 
 
-    if (!sorted) 
+    const int W = tab.W; 
+    long lo = std::max(k - W, 0l); 
+    long hi = std::min(k + W - 1, (long) N - 1); 
+    double inv_spacing = (hi - lo) / (tt[hi] - tt[lo]); 
+
+    double sum = 0, wsum = 0; 
+    for (long i = lo; i <= hi; i++) 
     {
-      t_sorted = new double[N]; 
-      std::partial_sort_copy(t,t+N, t_sorted, t_sorted+N); 
-      t = t_sorted; 
+      double w = tab.eval((t - tt[i]) * inv_spacing); 
+      sum += w * y[i]; 
+      wsum += w; 
     }
+    return wsum != 0 ? sum / wsum : y[k]; 
+  }
+
+  /* Finds the evenly spaced samples u (starting at t0, dt apart) which, interpolated with sinc_even, give back the input at its
+   * sample times. Each iteration adds the residuals at the sample times to the grid samples they are nearest to. For small jitter
+   * that converges quickly, but it isn't guaranteed to near half a sample (the kernel is then about 0.64 on both neighbors), so 
+   * a step that doesn't reduce the residual is undone and retried at half the size. The result is the best u found, which 
+   * for large jitter may not reach the tolerance. Returns false if the samples are more than half a sample from the grid. */ 
 
-    TLockGuard lock(&m_); //probably the accelerator is not threadsafe 
+  static bool sinc_regrid(const sinc_table_t & tab, const Interpolatable * in, std::vector<double> & u, double * t0, double * dt) 
+  {
+    size_t N = in->N(); 
+    if (N < 2) return false; 
+    const double * t = in->t(); 
+    const double * y = in->y(); 
+
+    // least-squares fit of t = a + b i 
+    double mi = 0.5 * (N-1); 
+    double mt = 0; 
+    for (size_t i = 0; i < N; i++) mt += t[i]; 
+    mt /= N; 
+    double sit = 0, sii = 0; 
+    for (size_t i = 0; i < N; i++) 
+    {
+      sit += (i - mi) * (t[i] - mt); 
+      sii += (i - mi) * (i - mi); 
+    }
+    double b = sit / sii; 
+    double a = mt - b * mi; 
+    if (!(b > 0)) return false; 
+
+    std::vector<double> x(N); 
+    double energy = 0; 
+    for (size_t i = 0; i < N; i++) 
+    {
+      x[i] = (t[i] - a) / b; 
+      if (!(fabs(x[i] - i) < 0.5)) return false; 
+      energy += y[i] * y[i]; 
+    }
 
-    //initialize the spline if it's not initialized already 
-    if (!gsl_s_) 
+    auto residual = [&](const std::vector<double> & uu, std::vector<double> & rr) 
     {
-      if (input_->N() < gsl_interp_type_min_size(gsl_t_))
+      double sum = 0; 
+      for (size_t i = 0; i < N; i++) 
       {
-         memset(y,0,N*sizeof(double)); 
-         return y; 
+        rr[i] = y[i] - sinc_even(tab, N, &uu[0], x[i]); 
+        sum += rr[i] * rr[i]; 
       }
+      return sum; 
+    }; 
+
+    u.assign(y, y + N); 
+    std::vector<double> r(N), try_u(N), try_r(N); 
+    double rr = residual(u, r); 
+    double step = 1; 
+    for (int iter = 0; iter < 50; iter++) 
+    {
+      if (rr <= 1e-12 * energy) break; //well below what the kernel can do anyway 
 
-      if (!gsl_a_) gsl_a_ = gsl_interp_accel_alloc(); 
-      else gsl_interp_accel_reset(gsl_a_); 
+      for (size_t i = 0; i < N; i++) try_u[i] = u[i] + step * r[i]; 
+      double try_rr = residual(try_u, try_r); 
+      if (!(try_rr < rr)) 
+      {
+        //made things worse, so u stays put and the next try is more cautious 
+        step *= 0.5; 
+        if (step < 1./64) break; 
+        continue; 
+      }
 
-      gsl_s_ = gsl_spline_alloc(gsl_t_, input_->N()); 
-      gsl_spline_init(gsl_s_, input_->t(), input_->y(), input_->N()); 
+      u.swap(try_u); 
+      r.swap(try_r); 
+      rr = try_rr; 
     }
 
-    for (size_t i = 0; i < N; i++)
+    *t0 = a; 
+    *dt = b; 
+    return true; 
+  }
+
+  /* The regridded uneven input. If the regridding failed, y is empty. */ 
+  struct sinc_grid_t 
+  {
+    std::vector<double> y; 
+    double t0; 
+    double dt; 
+  }; 
+
+  static void delete_sinc_grid(sinc_grid_t * g) { delete g; } 
+
+  /* Output times for sinc_eval */ 
+  struct sinc_times_t 
+  { 
+    const double * t; 
+    double operator()(size_t i) const { return t[i]; } 
+  }; 
+
+  struct sinc_even_times_t 
+  { 
+    double t0, dt; 
+    double operator()(size_t i) const { return t0 + i * dt; } 
+  }; 
+
+  template <typename Times> 
+  static double * sinc_eval(const sinc_table_t & tab, const Interpolatable * in, const sinc_grid_t * grid,
+                            size_t N, Times t, double * y, bool sorted) 
+  {
+    if (!y) y = new double[N]; 
+
+    size_t n = in ? in->N() : 0; 
+    if (!n) 
     {
-      y[i] = gsl_spline_eval(gsl_s_, t[i], gsl_a_); 
+      memset(y, 0, N * sizeof(double)); 
+      return y; 
     }
 
-    if (t_sorted) delete [] t_sorted; 
+    const double * in_y = in->y(); 
+    if (const EvenRepresentation * even = dynamic_cast<const EvenRepresentation *>(in)) 
+    {
+      double t0 = even->t0(); 
+      double inv_dt = 1. / even->dt(); 
+      for (size_t i = 0; i < N; i++) y[i] = sinc_even(tab, n, in_y, (t(i) - t0) * inv_dt); 
+      return y; 
+    }
+
+    const double * tt = in->t(); 
+    if (grid->y.size() == n) 
+    {
+      const double * u = &grid->y[0]; 
+      double inv_dt = 1. / grid->dt; 
+      for (size_t i = 0; i < N; i++) 
+      {
+        double ti = t(i); 
+        y[i] = !(ti > tt[0]) ? in_y[0] : ti >= tt[n-1] ? in_y[n-1] : sinc_even(tab, n, u, (ti - grid->t0) * inv_dt); 
+      }
+    }
+    else
+    {
+      size_t hint = 0; 
+      for (size_t i = 0; i < N; i++) 
+      {
+        if (!sorted) hint = 0; 
+        y[i] = sinc_uneven(tab, n, tt, in_y, t(i), &hint); 
+      }
+    }
 
     return y; 
   }
 
-  void GSLInterpolator::setInput(const TimeRepresentation * in)
+
+  SincInterpolator::SincInterpolator(const Options * opt) 
+    : grid_(0) 
   {
-    Interpolator::setInput(in); 
+    table_ = get_sinc_table(opt ? *opt : Options()); 
+  }
+
+  SincInterpolator::~SincInterpolator() 
+  {
+    delete grid_; 
+  }
+
+  const void * SincInterpolator::opt() const 
+  {
+    return &table_->opt; 
+  }
+
+  void SincInterpolator::setInput(const Interpolatable * input) 
+  {
+    Interpolator::setInput(input); 
+    delete grid_; 
+    grid_ = 0; 
+  }
+
+  const sinc_grid_t * SincInterpolator::grid() const
+  {
+    if (!input_ || dynamic_cast<const EvenRepresentation *>(input_)) return 0; 
+    sinc_grid_t * g = __atomic_load_n(&grid_, __ATOMIC_ACQUIRE); 
+    if (g) return g; 
+
+    g = new sinc_grid_t; 
+    if (!sinc_regrid(*table_, input_, g->y, &g->t0, &g->dt)) g->y.clear(); 
+    return publish(&grid_, g, delete_sinc_grid); 
+  }
 
-    if (input_->N() < gsl_interp_type_min_size(gsl_t_))
+  double * SincInterpolator::evalMany(size_t N, const double * t, double * y, bool sorted) const
+  {
+    sinc_times_t times = { t }; 
+    return sinc_eval(*table_, input_, grid(), N, times, y, sorted); 
+  }
+
+  double * SincInterpolator::evalEven(size_t N, double t0, double dt, double * y) const
+  {
+    sinc_even_times_t times = { t0, dt }; 
+    return sinc_eval(*table_, input_, grid(), N, times, y, true); 
+  }
+
+
+  GSLInterpolator::GSLInterpolator(const gsl_interp_type * type)
+  {
+    if (!type) type = gsl_interp_akima; 
+    gsl_t_ = type; 
+    gsl_s_  = NULL;
+  }
+
+  GSLInterpolator::~GSLInterpolator() 
+  {
+    if (gsl_s_) gsl_spline_free(gsl_s_); 
+  }
+
+  const gsl_spline * GSLInterpolator::spline() const
+  {
+    gsl_spline * s = __atomic_load_n(&gsl_s_, __ATOMIC_ACQUIRE); 
+    if (s) return s; 
+
+    s = gsl_spline_alloc(gsl_t_, input_->N()); 
+    gsl_spline_init(s, input_->t(), input_->y(), input_->N()); 
+    return publish(&gsl_s_, s, gsl_spline_free); 
+  }
+
+  double * GSLInterpolator::evalMany(size_t N, const double * t, double *y, bool sorted) const
+  {
+    if (!y) y = new double[N]; 
+
+    if (!input_ || input_->N() < gsl_interp_type_min_size(gsl_t_))
     {
-        fprintf(stderr,"WARNING: Input smaller than minimum size interp type, %u. Will zero output.\n",
-                gsl_interp_type_min_size(gsl_t_)); 
+      log::out(log::LOG_WARN, "GSLInterpolator: input smaller than the minimum size for %s (%u). Will zero output.\n",
+               gsl_t_->name, gsl_interp_type_min_size(gsl_t_)); 
+      memset(y,0,N*sizeof(double)); 
+      return y; 
     }
- 
-    if (gsl_s_) 
+
+    const gsl_spline * s = spline(); 
+
+    //the accelerator just caches the last interval found, so each call gets its own. It helps as long as the times are mostly increasing. 
+    gsl_interp_accel acc; 
+    gsl_interp_accel_reset(&acc); 
+    (void) sorted; 
+
+    for (size_t i = 0; i < N; i++)
     {
-      gsl_spline_free(gsl_s_); 
+      y[i] = gsl_spline_eval(s, t[i], &acc); 
     }
+
+    return y; 
+  }
+
+  void GSLInterpolator::setInput(const Interpolatable * in)
+  {
+    Interpolator::setInput(in); 
+    if (gsl_s_) gsl_spline_free(gsl_s_); 
     gsl_s_ = 0; 
   }
 }
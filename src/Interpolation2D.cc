@@ -1,4 +1,5 @@
 #include "nurfana/Interpolation2D.h" 
+#include "nurfana/Logging.h" 
 
 
 namespace nurfana
@@ -8,8 +9,10 @@ namespace nurfana
     : t_(t), x_(x,x+nx), y_(y,y+ny), z_(nx*ny), h_(0), hist_ready_(false), dirty_(true)
   {
     if (z) std::copy(z,z+nx*ny, z_.begin()); 
+    zv_ = &z_[0]; 
 
     initGSL(); 
+    uniform_ = false; 
   }
 
 
@@ -17,11 +20,13 @@ namespace nurfana
     : t_(t), x_(nx), y_(ny), z_(nx*ny), h_(0), hist_ready_(false), dirty_(true) 
   {
     if (z) std::copy(z,z+nx*ny, z_.begin()); 
+    zv_ = &z_[0]; 
     double dx = (xmax - xmin)/(nx-1); 
     double dy = (ymax - ymin)/(ny-1); 
     for (int i = 0; i < nx; i++) x_[i] = xmin + dx * i; 
     for (int i = 0; i < ny; i++) y_[i] = ymin + dy * i; 
     initGSL(); 
+    setUniform(); 
 
 
   }
@@ -40,6 +45,7 @@ namespace nurfana
         z_[i + j * x_.size()] = hist.GetBinContent(i+1,j+1); 
       }
     }
+    zv_ = &z_[0]; 
 
     //we will exactly copy the binning from the histogram in this case... 
      h_ = new TH2D("grid","Grid Interpolator", 10,0,1,10,0,1); 
@@ -50,18 +56,36 @@ namespace nurfana
      if (hist.GetXaxis()->GetXbins()->GetSize()) 
      {
        h_->SetBins(x_.size(), hist.GetXaxis()->GetXbins()->GetArray(), y_.size(), hist.GetYaxis()->GetXbins()->GetArray());
+       uniform_ = false; 
 
      }
      else
      {
        h_->SetBins(x_.size(), hist.GetXaxis()->GetXmin(), hist.GetXaxis()->GetXmax(), 
                                y_.size(), hist.GetYaxis()->GetXmin(), hist.GetYaxis()->GetXmax()); 
+       setUniform(); 
 
      }
 
      initGSL(); 
   }
 
+  GridInterpolator2D * GridInterpolator2D::makeView(int nx, double xmin, double xmax, int ny, double ymin, double ymax, const double * z, Type t) 
+  {
+    return new GridInterpolator2D(nx, xmin, xmax, ny, ymin, ymax, z, t, true); 
+  }
+
+  GridInterpolator2D::GridInterpolator2D(int nx, double xmin, double xmax, int ny, double ymin, double ymax, const double * z, Type t, bool) 
+    : t_(t), x_(nx), y_(ny), zv_(z), h_(0), hist_ready_(false), dirty_(true) 
+  {
+    double dx = (xmax - xmin)/(nx-1); 
+    double dy = (ymax - ymin)/(ny-1); 
+    for (int i = 0; i < nx; i++) x_[i] = xmin + dx * i; 
+    for (int i = 0; i < ny; i++) y_[i] = ymin + dy * i; 
+    initGSL(); 
+    setUniform(); 
+  }
+
   void GridInterpolator2D::initGSL() 
   {
 
@@ -70,6 +94,35 @@ namespace nurfana
     ay_ = gsl_interp_accel_alloc(); 
   }
 
+  void GridInterpolator2D::setUniform() 
+  {
+    uniform_ = x_.size() > 1 && y_.size() > 1; 
+    if (!uniform_) return; 
+    x0_ = x_[0]; 
+    y0_ = y_[0]; 
+    dxinv_ = (x_.size()-1) / (x_[x_.size()-1] - x_[0]); 
+    dyinv_ = (y_.size()-1) / (y_[y_.size()-1] - y_[0]); 
+  }
+
+  double GridInterpolator2D::evalBilinear(double x, double y) const 
+  {
+    double fx = (x - x0_) * dxinv_; 
+    double fy = (y - y0_) * dyinv_; 
+    int nx = x_.size(); 
+    int ny = y_.size(); 
+
+    //unlike the GSL version, the edges are included 
+    if (!(fx >= 0 && fx <= nx-1 && fy >= 0 && fy <= ny-1)) return 0; 
+
+    int i = fx < nx-1 ? (int) fx : nx-2; 
+    int j = fy < ny-1 ? (int) fy : ny-2; 
+    double wx = fx - i; 
+    double wy = fy - j; 
+
+    const double * z = zv_ + i + j * nx; 
+    return (1-wy) * ( (1-wx) * z[0] + wx * z[1]) + wy * ( (1-wx) * z[nx] + wx * z[nx+1]); 
+  }
+
   GridInterpolator2D::~GridInterpolator2D() 
   {
 
@@ -82,6 +135,11 @@ namespace nurfana
 
   void GridInterpolator2D::set(int i, int j, double z) 
   {
+    if (isView()) 
+    {
+      log::out(log::LOG_ERROR, "GridInterpolator2D::set: can't modify a view\n"); 
+      return; 
+    }
     dirty_  = true; 
     hist_ready_ = false; 
     z_[i + j * x_.size()] = z; 
@@ -90,14 +148,21 @@ namespace nurfana
   void GridInterpolator2D::setupInterp() const
   {
     if (!dirty_) return; 
-    gsl_spline2d_init(s_, &x_[0], &y_[0], &z_[0], x_.size(), y_.size()); 
+    gsl_spline2d_init(s_, &x_[0], &y_[0], zv_, x_.size(), y_.size()); 
     dirty_ = false; 
   }
 
   double * GridInterpolator2D::evalMany(int N, const double * x, const double * y, double * answer) const
   {
-    setupInterp(); 
     if (!answer) answer = new double[N]; 
+
+    if (isFast()) 
+    {
+      for (int i = 0; i < N; i++) answer[i] = evalBilinear(x[i], y[i]); 
+      return answer; 
+    }
+
+    setupInterp(); 
     for (int i = 0; i < N; i++) 
     {
       answer[i] = outOfBounds(x[i],y[i]) ? 0 : gsl_spline2d_eval(s_, x[i],y[i], ax_, ay_); 
@@ -107,9 +172,16 @@ namespace nurfana
 
   double * GridInterpolator2D::evalAxis(int N, double a, const double * b, Axis ca, double * answer) const
   {
-    setupInterp(); 
     if (!answer) answer = new double[N]; 
 
+    if (isFast()) 
+    {
+      for (int i = 0; i < N; i++) answer[i] = ca == XAxis ? evalBilinear(a, b[i]) : evalBilinear(b[i], a); 
+      return answer; 
+    }
+
+    setupInterp(); 
+
     for (int i = 0; i < N; i++)
     {
       answer[i] = ca == XAxis ? ( outOfBounds(a,b[i]) ? 0 : gsl_spline2d_eval(s_, a,b[i], ax_, ay_) ):
@@ -172,7 +244,7 @@ namespace nurfana
       for (size_t j = 0; j < y_.size(); j++) 
       {
 //        printf("%lu %lu %g %g %g\n",i,j,x_[i], y_[j], z_[x_.size() * j +i]); 
-        h_->SetBinContent(i+1,j+1, z_[x_.size() * j + i]); 
+        h_->SetBinContent(i+1,j+1, zv_[x_.size() * j + i]); 
       }
     }
     h_->SetStats(false); 
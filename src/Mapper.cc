@@ -1,6 +1,8 @@
 #include "nurfana/Mapper.h" 
 #include "nurfana/Event.h" 
 #include "nurfana/Consts.h" 
+#include "nurfana/Logging.h" 
+#include <algorithm> 
 
 
 namespace nurfana
@@ -16,6 +18,17 @@ namespace nurfana
     }
   }
 
+  void Mapper::getDelays(int npairs, const int * first, const int * second, size_t npoints, const double * X, double * delays) const
+  {
+    for (int p = 0; p < npairs; p++) 
+    {
+      for (size_t k = 0; k < npoints; k++) 
+      {
+        delays[p * npoints + k] = getDelay(first[p], second[p], X + k * ndim()); 
+      }
+    }
+  }
+
   ///Elevation Mapper
   double ElevationMapper::getDelay(int i, int j, const double * X) const
   {
@@ -32,12 +45,193 @@ namespace nurfana
     double sin_phi = sin(phi); 
     double cos_theta = cos(theta); 
     double sin_theta = sin(theta); 
-    TVector3 dir ( cos_phi * cos_theta, sin_phi * cos_theta, sin_theta); 
-    TVector3 diff( ants_[j]->position() - ants_[i]->position()); 
+    const TVector3 & pi = ants_[i]->position(); 
+    const TVector3 & pj = ants_[j]->position(); 
+
+    return ( cos_phi * cos_theta * (pj.X() - pi.X()) 
+           + sin_phi * cos_theta * (pj.Y() - pi.Y()) 
+           + sin_theta * (pj.Z() - pi.Z()) ) / (n_*C); 
+  }
+
+
+  ///IceRZMapper
+  IceRZMapper::IceRZMapper(const ice::Model & ice, const Event * ev, int nr, double max_r, int ndepth, double max_depth) 
+    : IceRZMapper(2, ice, nr, max_r, ndepth, max_depth) 
+  {
+    if (ev) setEventTemplate(*ev); 
+  }
+
+  IceRZMapper::IceRZMapper(unsigned ndim, const ice::Model & ice, int nr, double max_r, int ndepth, double max_depth) 
+    : Mapper(ndim, 0), ice_(ice), nr_(nr), max_r_(max_r), ndepth_(ndepth), max_depth_(max_depth) 
+  {
+  }
+
+  IceRZMapper::~IceRZMapper() 
+  {
+    for (unsigned i = 0; i < tables_.size(); i++) delete tables_[i]; 
+  }
 
-    return dir.Dot(diff) / (n_*C); 
+  int IceRZMapper::findTable(double depth) const 
+  {
+    for (unsigned i = 0; i < depths_.size(); i++) 
+    {
+      if (fabs(depths_[i] - depth) < 1e-3) return i; 
+    }
+    return -1; 
   }
 
+  void IceRZMapper::setTable(double depth, GridInterpolator2D * table) 
+  {
+    if (!table->isFast()) 
+    {
+      log::out(log::LOG_WARN, "IceRZMapper: the table for depth %g is not bilinear on an even grid, so it is not thread-safe\n", depth); 
+    }
+
+    int i = findTable(depth); 
+    if (i < 0) 
+    {
+      depths_.push_back(depth); 
+      tables_.push_back(table); 
+    }
+    else
+    {
+      delete tables_[i]; 
+      tables_[i] = table; 
+    }
+  }
+
+  void IceRZMapper::setEventTemplate(const Event & event) 
+  {
+    Mapper::setEventTemplate(event); 
+    ant_table_.resize(ants_.size()); 
+
+    for (unsigned i = 0; i < ants_.size(); i++) 
+    {
+      double depth = -ants_[i]->position().Z(); 
+      int t = findTable(depth); 
+      if (t < 0) 
+      {
+        depths_.push_back(depth); 
+        tables_.push_back(makeStraightLineTable(depth)); 
+        t = tables_.size()-1; 
+      }
+      ant_table_[i] = t; 
+    }
+  }
+
+  GridInterpolator2D * IceRZMapper::makeStraightLineTable(double antenna_depth) const 
+  {
+    double za = std::max(antenna_depth, 0.); 
+
+    // cumulative integral of n(z), on a grid finer than the table
+    double zmax = std::max(max_depth_, za); 
+    double dzf = max_depth_ / (16 * (ndepth_-1)); 
+    int nf = ceil(zmax / dzf) + 2; 
+    std::vector<double> cum(nf); 
+    double last_n = ice_.n(0); 
+    cum[0] = 0; 
+    for (int k = 1; k < nf; k++) 
+    {
+      double n = ice_.n(k * dzf); 
+      cum[k] = cum[k-1] + 0.5 * (n + last_n) * dzf; 
+      last_n = n; 
+    }
+
+    auto integral = [&](double z) 
+    {
+      double f = z / dzf; 
+      int k = std::min((int) f, nf-2); 
+      return cum[k] + (f - k) * (cum[k+1] - cum[k]); 
+    }; 
+
+    std::vector<double> t(nr_ * ndepth_); 
+    double Na = integral(za); 
+
+    for (int j = 0; j < ndepth_; j++) 
+    {
+      double z = j * max_depth_ / (ndepth_-1); 
+      double dz = z - za; 
+
+      //the average index of refraction along the path only depends on the depths 
+      double navg = fabs(dz) > 1e-6 ? (integral(z) - Na) / dz : ice_.n(za); 
+
+      for (int i = 0; i < nr_; i++) 
+      {
+        double r = i * max_r_ / (nr_-1); 
+        t[i + j * nr_] = sqrt(r*r + dz*dz) * navg / C; 
+      }
+    }
+
+    return new GridInterpolator2D(nr_, 0, max_r_, ndepth_, 0, max_depth_, &t[0], GridInterpolator2D::Bilinear); 
+  }
+
+  bool IceRZMapper::canUseAntenna(int i, const double * X) const 
+  {
+    double r = horizontalDistance(i,X); 
+    return r >= 0 && r <= max_r_ && X[1] >= 0 && X[1] <= max_depth_; 
+  }
+
+  double IceRZMapper::getTime(int i, const double * X) const 
+  {
+    return tables_[ant_table_[i]]->eval(horizontalDistance(i,X), X[1]); 
+  }
+
+  double IceRZMapper::getDelay(int i, int j, const double * X) const 
+  {
+    return getTime(i,X) - getTime(j,X); 
+  }
+
+  void IceRZMapper::getDelays(int npairs, const int * first, const int * second, size_t npoints, const double * X, double * delays) const 
+  {
+    //each antenna's times are looked up once (and in the azimuthally symmetric case, once per table), then the delays are just differences 
+    const bool symmetric = ndim() == 2; 
+    unsigned nd = ndim(); 
+    std::vector<double> r(npoints); 
+    std::vector<double> z(npoints); 
+    for (size_t k = 0; k < npoints; k++) 
+    {
+      r[k] = X[k * nd]; 
+      z[k] = X[k * nd + 1]; 
+    }
+
+    std::vector<std::vector<double> > times(symmetric ? tables_.size() : ants_.size()); 
+
+    auto getTimes = [&](int i) -> const double * 
+    {
+      std::vector<double> & t = times[symmetric ? ant_table_[i] : i]; 
+      if (!t.size()) 
+      {
+        t.resize(npoints); 
+        if (!symmetric) for (size_t k = 0; k < npoints; k++) r[k] = horizontalDistance(i, X + k * nd); 
+        tables_[ant_table_[i]]->evalMany(npoints, &r[0], &z[0], &t[0]); 
+      }
+      return &t[0]; 
+    }; 
+
+    for (int p = 0; p < npairs; p++) 
+    {
+      const double * ti = getTimes(first[p]); 
+      const double * tj = getTimes(second[p]); 
+      double * d = delays + p * npoints; 
+      for (size_t k = 0; k < npoints; k++) d[k] = ti[k] - tj[k]; 
+    }
+  }
+
+
+  ///IceRZPhiMapper
+  IceRZPhiMapper::IceRZPhiMapper(const ice::Model & ice, const Event * ev, int nr, double max_r, int ndepth, double max_depth) 
+    : IceRZMapper(3, ice, nr, max_r, ndepth, max_depth) 
+  {
+    if (ev) setEventTemplate(*ev); 
+  }
+
+  double IceRZPhiMapper::horizontalDistance(int i, const double * X) const 
+  {
+    double phi = X[2] * TMath::DegToRad(); 
+    double dx = X[0] * cos(phi) - ants_[i]->position().X(); 
+    double dy = X[0] * sin(phi) - ants_[i]->position().Y(); 
+    return sqrt(dx*dx + dy*dy); 
+  }
 
 } 
 
@@ -1,5 +1,8 @@
 #include "nurfana/SignalOps.h" 
+#include "nurfana/Event.h" 
 #include "nurfana/Logging.h" 
+#include "nurfana_simd.h" 
+#include "TMath.h" 
 
 namespace nurfana
 {
@@ -21,7 +24,7 @@ namespace nurfana
     }
 
 
-    Waveform * correlation(const Waveform *A, const Waveform *B, int npad = 0, double scale = 1, Waveform * out = 0) 
+    Waveform * correlation(const Waveform *A, const Waveform *B, int npad, double scale, Waveform * out) 
     {
 
       if (A->freq().Nt() != B->freq().Nt())
@@ -33,7 +36,7 @@ namespace nurfana
       double offset = A->freq().t0()  - B->freq().t0(); 
 
       if (!out) out = new Waveform(*A); 
-      else if (A!=out || B!=out) *out = *A; 
+      else if (A!=out && B!=out) *out = *A; 
 
       unsigned N = out->freq().Nt(); 
       double inv = 1./(scale*N);
@@ -60,5 +63,41 @@ namespace nurfana
       return out; 
     }
 
+
+    void shift(Waveform & wf, double delay) 
+    {
+      if (delay == 0) return; 
+
+      FrequencyRepresentation & F = wf.updateFreq(); 
+      size_t Nf = F.Nf(); 
+      if (!F.Nt()) return; 
+
+      static thread_local fft::aligned_vector<std::complex<double> > w; 
+      static thread_local std::vector<double> tmp; 
+      w.resize(Nf); 
+      tmp.resize(2 * (size_t) ceil(sqrt((double) Nf))); 
+      simd::phase_ramp(Nf, -2 * TMath::Pi() * F.df() * delay, (double *) &w[0], &tmp[0]); 
+
+      std::complex<double> * Y = F.updateY(); 
+      simd::cmul(Nf, (const double *) Y, (const double *) &w[0], (double *) Y); 
+
+      //at the Nyquist frequency, the samples only see the real part 
+      if (F.Nt() % 2 == 0) Y[Nf-1] = Y[Nf-1].real(); 
+    }
+
+    void shift(Event & ev, const std::vector<double> & delays) 
+    {
+      if (delays.size() < ev.nChannels()) 
+      {
+        log::out(log::LOG_ERROR, "shift: %zu delays for %u channels\n", delays.size(), ev.nChannels()); 
+        return; 
+      }
+
+      for (unsigned i = 0; i < ev.nChannels(); i++) 
+      {
+        shift(*ev.channel(i)->wf(), delays[i]); 
+      }
+    }
+
   }
 }
@@ -1,7 +1,9 @@
 #include "nurfana/PhasedArray.h" 
 
-#include "TGraph.h" 
 #include "TMutex.h" 
+#include "TROOT.h" 
+#include <unistd.h> 
+#include <cstdio> 
 #include <map> 
 
 
@@ -27,19 +29,24 @@ namespace nurfana
     static std::map<double, Antenna*> antennas; 
     static TMutex m; 
 
-    if (!antennas.count(depth))
-    {
-      TLockGuard l(&m); 
-      antennas[depth] = new Antenna(0,0,-depth,Antenna::VPOL); 
-    }
-
-    return antennas[depth]; 
+    //readers on different threads share the map, so the lookup has to be locked as well as the insertion 
+    TLockGuard l(&m); 
+    Antenna *& ant = antennas[depth]; 
+    if (!ant) ant = new Antenna(0,0,-depth,Antenna::VPOL); 
+    return ant; 
   }
 
   void PhasedArrayReader::setupChain(const char * dir, int nruns, const int * runs) 
   {
     npEv_ = 0; 
     npHd_ = 0; 
+    pfHd_ = 0; 
+    pf_hd_ = 0; 
+    cache_size_ = -1; 
+    pf_start_ = 0; 
+    pf_next_ = 0; 
+    pf_gen_ = 0; 
+    pf_stop_ = false; 
 
     ch_ev_.SetName("event"); 
     ch_hd_.SetName("header"); 
@@ -53,15 +60,13 @@ namespace nurfana
       fi.Form("%s/run%d/header.filtered.root", dir, runs[i]); 
 
       //does filtered file exist? 
-      if (!access(fi.Data(),F_OK))
-      {
-        ch_hd_.Add(fi.Data()); 
-      }
-      else //try just normal file
+      if (access(fi.Data(),F_OK))
       {
+        //try just normal file
         fi.Form("%s/run%d/header.root", dir, runs[i]); 
-        ch_hd_.Add(fi.Data()); 
       }
+      ch_hd_.Add(fi.Data()); 
+      hd_files_.push_back(fi); 
     }
 
     ch_ev_.SetBranchAddress("event",&npEv_); 
@@ -71,32 +76,39 @@ namespace nurfana
   }
 
 
-  int PhasedArrayReader::loadEvent(int i) 
+  int PhasedArrayReader::fillChannels(std::vector<Channel> & chans, nuphase::Event * ev, const nuphase::Header * hd) 
   {
-    if (!ch_ev_.GetEntry(i)) return 1; 
-
-    channels().clear(); 
-
     //just hardcode stuff for now... 
     // this will have to get more complicated in the future 
     
-    static nuphase::CalibrationInfo ci; 
+    static const nuphase::CalibrationInfo ci; 
+    const int nchan = 8; 
+
+    bool old_config = (hd->event_number >> 32) < 400; 
+    ev->setCalibrationInfo(ci); 
+
+    static const char * names[nchan] = { "NUPHASE_CH0", "NUPHASE_CH1", "NUPHASE_CH2", "NUPHASE_CH3", 
+                                         "NUPHASE_CH4", "NUPHASE_CH5", "NUPHASE_CH6", "NUPHASE_CH7" }; 
 
-    bool old_config = (npHd_->event_number >> 32) < 400; 
-    npEv_->setCalibrationInfo(ci); 
+    //The channels (and their waveforms) are recycled from previous events, so usually nothing needs to be allocated here. 
+    recycleChannels(chans, nchan); 
+
+    const Digitizer * dig = &Digitizer::PhasedArray(); 
+    const int N = ev->getBufferLength(); 
      
     //master
     double depth = 196; 
-    for (int i = 0; i < 8; i++) 
+    for (int i = 0; i < nchan; i++) 
     {
-      //there are way too many copies here. Will need to fix this... 
-      TGraph * g = npEv_->getGraph(i); 
-      EvenRepresentation even(g->GetN(), g->GetY(), g->GetX()[1] - g->GetX()[0], g->GetX()[0]); 
-      delete g; 
-      Waveform * wf = new Waveform(even); 
       if (i >= 6 && !old_config) depth+=1; 
-      TString name; name.Form("NUPHASE_CH%d", i); 
-      channels().emplace_back(name.Data(), wf, getPhasedArrayAntenna(depth), getPhasedArrayResponse(depth), &Digitizer::PhasedArray()); 
+      const Antenna * ant = getPhasedArrayAntenna(depth); 
+      const Response * resp = getPhasedArrayResponse(depth); 
+
+      chans[i].SetNameTitle(names[i], names[i]); 
+      chans[i].reset(ant, resp, dig); 
+
+      //copy the calibrated samples straight into the waveform's storage
+      chans[i].wf()->setEven(N, ev->getData(i), dig->getNominalDt(), 0); 
       depth+=1; 
     }
 
@@ -104,7 +116,108 @@ namespace nurfana
     //TODO, hpol channels, etc. 
     
     return 0; 
+  }
+
 
+  int PhasedArrayReader::loadEvent(int i) 
+  {
+    if (!slots_.size()) 
+    {
+      if (!ch_ev_.GetEntry(i)) return 1; 
+      return fillChannels(channels(), npEv_, npHd_); 
+    }
+
+    //the read-ahead never fills these, so don't wait for them 
+    if (i < 0 || i >= nEvents()) return 1; 
+
+    int K = slots_.size(); 
+    std::unique_lock<std::mutex> l(pf_m_); 
+
+    //outside of the read-ahead window, start over from here 
+    if (i < pf_start_ || i >= pf_start_ + K) 
+    {
+      pf_gen_++; 
+      pf_start_ = i; 
+      pf_next_ = i; 
+      for (int j = 0; j < K; j++) slots_[j].ready = false; 
+      pf_cv_.notify_all(); 
+    }
+
+    Slot & s = slots_[i % K]; 
+    pf_cv_.wait(l, [&] { return s.ready && s.entry == i; }); 
+
+    //hand over the decoded channels, the old ones get recycled by the read-ahead thread
+    std::swap(channels(), s.channels); 
+    int ret = s.status; 
+    s.ready = false; 
+    s.entry = -1; 
+    pf_start_ = i+1; 
+    pf_cv_.notify_all(); 
+
+    return ret; 
+  }
+
+  void PhasedArrayReader::prefetchLoop(int nev) 
+  {
+    std::unique_lock<std::mutex> l(pf_m_); 
+    int K = slots_.size(); 
+
+    while (true) 
+    {
+      pf_cv_.wait(l, [&] { return pf_stop_ || (pf_next_ < pf_start_ + K && pf_next_ < nev); }); 
+      if (pf_stop_) return; 
+
+      int entry = pf_next_++; 
+      int gen = pf_gen_; 
+      Slot & s = slots_[entry % K]; 
+      s.ready = false; 
+
+      //the slot is ours until it's marked ready, so do the I/O without holding the lock 
+      l.unlock(); 
+      int status = 1; 
+      if (ch_ev_.GetEntry(entry) && pf_hd_->GetEntry(entry))
+      {
+        status = fillChannels(s.channels, npEv_, pfHd_); 
+      }
+      l.lock(); 
+
+      if (gen == pf_gen_) 
+      {
+        s.entry = entry; 
+        s.status = status; 
+        s.ready = true; 
+        pf_cv_.notify_all(); 
+      }
+    }
+  }
+
+  void PhasedArrayReader::setPrefetch(int nahead) 
+  {
+    stopPrefetch(); 
+    slots_.clear(); 
+    if (nahead <= 0) return; 
+
+    ROOT::EnableThreadSafety(); 
+
+    //loadMeta keeps using ch_hd_, so the read-ahead thread needs its own header chain
+    if (!pf_hd_) 
+    {
+      pf_hd_ = new TChain("header"); 
+      for (unsigned i = 0; i < hd_files_.size(); i++) pf_hd_->Add(hd_files_[i].Data()); 
+      pf_hd_->SetBranchAddress("head",&pfHd_); 
+      if (cache_size_ >= 0) 
+      {
+        pf_hd_->SetCacheSize(cache_size_); 
+        pf_hd_->AddBranchToCache("*",true); 
+      }
+    }
+
+    slots_.resize(nahead); 
+    pf_stop_ = false; 
+    pf_gen_++; 
+    pf_start_ = current_entry_; 
+    pf_next_ = current_entry_; 
+    pf_thread_ = std::thread(&PhasedArrayReader::prefetchLoop, this, nEvents()); 
   }
 
   int PhasedArrayReader::loadMeta(int i) 
@@ -124,27 +237,82 @@ namespace nurfana
 
 
 #else
-  void PhasedArray::setupChain(const char * dir, int nruns, const int * runs) 
+  void PhasedArrayReader::setupChain(const char * dir, int nruns, const int * runs) 
   {
     (void) dir; 
     (void) nruns; 
     (void) runs; 
+    pf_hd_ = 0; 
+    cache_size_ = -1; 
+    pf_start_ = 0; 
+    pf_next_ = 0; 
+    pf_gen_ = 0; 
+    pf_stop_ = false; 
     fprintf(stderr,"Not compiled with Phased Array support\n"); 
   }
 
-  int PhasedArray::loadEvent(int i) 
+  int PhasedArrayReader::loadEvent(int i) 
   {
     (void) i; 
     return -1; 
   }
 
-  int PhasedArray::loadMeta(int i) 
+  int PhasedArrayReader::loadMeta(int i) 
   {
     (void) i; 
     return -1; 
   }
+
+  void PhasedArrayReader::prefetchLoop(int nev) 
+  {
+    (void) nev; 
+  }
+
+  void PhasedArrayReader::setPrefetch(int nahead) 
+  {
+    (void) nahead; 
+    fprintf(stderr,"Not compiled with Phased Array support\n"); 
+  }
 #endif
 
+  void PhasedArrayReader::stopPrefetch() 
+  {
+    if (!pf_thread_.joinable()) return; 
+
+    {
+      std::lock_guard<std::mutex> l(pf_m_); 
+      pf_stop_ = true; 
+    }
+    pf_cv_.notify_all(); 
+    pf_thread_.join(); 
+  }
+
+  void PhasedArrayReader::setCacheSize(long bytes) 
+  {
+    //the chains can't be touched while the read-ahead thread is using them
+    int nahead = slots_.size(); 
+    stopPrefetch(); 
+
+    cache_size_ = bytes; 
+    ch_ev_.SetCacheSize(bytes); 
+    ch_ev_.AddBranchToCache("*",true); 
+    ch_hd_.SetCacheSize(bytes); 
+    ch_hd_.AddBranchToCache("*",true); 
+    if (pf_hd_) 
+    {
+      pf_hd_->SetCacheSize(bytes); 
+      pf_hd_->AddBranchToCache("*",true); 
+    }
+
+    if (nahead) setPrefetch(nahead); 
+  }
+
+  PhasedArrayReader::~PhasedArrayReader() 
+  {
+    stopPrefetch(); 
+    delete pf_hd_; 
+  }
+
 
 
 }
@@ -0,0 +1,326 @@
+#include "nurfana/RayTable.h"
+#include "nurfana/Logging.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace nurfana
+{ 
+
+  namespace raytracer
+  { 
+
+  //bump this whenever the file layout or the meaning of the stored values changes
+  static const uint32_t table_version = 2; 
+  static const char table_magic[8] = { 'N','R','F','R','A','Y','T', 0 }; 
+
+  //the data start one page in, and each grid starts on a 64-byte boundary 
+  static const size_t header_size = 4096; 
+  static const size_t grid_align = 64 / sizeof(double); 
+
+  //number of depths the ice model is sampled at for the key
+  static const int nkey_samples = 256; 
+
+  struct table_header_t
+  { 
+    char magic[8]; 
+    uint32_t version; 
+    uint32_t nq; 
+    uint64_t key; 
+    int32_t nz; 
+    int32_t nd; 
+    double zmin; 
+    double zmax; 
+    double dmax; 
+    double z0; 
+    uint64_t data_offset; // bytes 
+    uint64_t grid_stride; // doubles 
+    uint64_t file_size; 
+  }; 
+
+
+  //64-bit FNV-1a
+  static void hash_bytes(uint64_t & h, const void * data, size_t n) 
+  { 
+    const unsigned char * p = (const unsigned char *) data; 
+    for (size_t i = 0; i < n; i++) 
+    { 
+      h ^= p[i]; 
+      h *= 1099511628211ull; 
+    } 
+  } 
+
+  static void hash_double(uint64_t & h, double x) { hash_bytes(h, &x, sizeof(x)); } 
+
+
+  uint64_t RayTable::computeKey(const ice::Model & ice, double z0, int nz, double zmin, double zmax, int nd, double dmax, const Options & opt) 
+  { 
+    uint64_t h = 14695981039346656037ull; 
+    hash_bytes(h, &table_version, sizeof(table_version)); 
+    hash_double(h, z0); 
+    hash_bytes(h, &nz, sizeof(nz)); 
+    hash_double(h, zmin); 
+    hash_double(h, zmax); 
+    hash_bytes(h, &nd, sizeof(nd)); 
+    hash_double(h, dmax); 
+
+    hash_double(h, opt.Rsurface); 
+    hash_double(h, opt.rel_tolerance); 
+    for (unsigned i = 0; i < opt.atten_fs.size(); i++) hash_double(h, opt.atten_fs[i]); 
+
+    // The models are arbitrary code, so we sample them over every depth a ray in the table can pass through.
+    hash_double(h, ice.iceDepth()); 
+    double top = 0; 
+    double bottom = std::max(z0, zmax); 
+    for (int i = 0; i < nkey_samples; i++) 
+    { 
+      double z = top + i * (bottom - top) / (nkey_samples-1); 
+      hash_double(h, ice.n(z)); 
+      for (unsigned j = 0; j < opt.atten_fs.size(); j++) hash_double(h, ice.attenuation(z, opt.atten_fs[j])); 
+    } 
+
+    return h; 
+  } 
+
+
+  RayTable::RayTable(const ice::Model & ice, double z0,
+                     int nz, double zmin, double zmax, int nd, double dmax,
+                     const Options & opt, int nthreads) 
+    : nz_(nz), nd_(nd), nq_(kAtten + opt.atten_fs.size()),
+      zmin_(zmin), zmax_(zmax), dmax_(dmax), z0_(z0) 
+  { 
+    key_ = computeKey(ice, z0, nz, zmin, zmax, nd, dmax, opt); 
+    map_ = 0; 
+    map_len_ = 0; 
+    setStride(); 
+    build(ice, opt, nthreads); 
+  } 
+
+  RayTable::~RayTable() 
+  { 
+    if (map_) munmap(map_, map_len_); 
+  } 
+
+  void RayTable::setStride() 
+  { 
+    grid_stride_ = ((size_t) nz_ * nd_ + grid_align - 1) / grid_align * grid_align; 
+  } 
+
+
+  void RayTable::build(const ice::Model & ice, const Options & opt, int nthreads) 
+  { 
+    data_.assign((size_t) kNBranches * nq_ * grid_stride_, NAN); 
+    base_ = &data_[0]; 
+
+    Raytracer * rt = Raytracer::make(ice, z0_, opt); 
+
+    // blocks of rows go to solveMany, which does the threading. The blocks just bound the memory used for the solutions.
+    int rows = std::max(1, 65536 / nd_); 
+    std::vector<double> zs, ds; 
+    std::vector<Solution> sols; 
+    bool * found = new bool[(size_t) rows * nd_]; 
+
+    for (int iz0 = 0; iz0 < nz_; iz0 += rows) 
+    { 
+      int iz1 = std::min(nz_, iz0 + rows); 
+      size_t n = (size_t) (iz1 - iz0) * nd_; 
+      zs.resize(n); 
+      ds.resize(n); 
+      sols.resize(n); 
+      for (int iz = iz0; iz < iz1; iz++) 
+      { 
+        for (int id = 0; id < nd_; id++) 
+        { 
+          zs[(iz-iz0) * nd_ + id] = z(iz); 
+          ds[(iz-iz0) * nd_ + id] = d(id); 
+        } 
+      } 
+
+      for (int b = 0; b < kNBranches; b++) 
+      { 
+        rt->solveMany(n, &zs[0], &ds[0], &sols[0], found, Turns::turnsWithNoSkip(b), nthreads); 
+
+        double * base = &data_[(size_t) b * nq_ * grid_stride_ + (size_t) iz0 * nd_]; 
+        size_t stride = grid_stride_; 
+        for (size_t k = 0; k < n; k++) 
+        { 
+          if (!found[k]) continue; 
+          const Solution & sol = sols[k]; 
+          base[kTime * stride + k] = sol.t; 
+          base[kTheta0 * stride + k] = sol.theta0; 
+          base[kTheta1 * stride + k] = sol.theta1; 
+          base[kPathLength * stride + k] = sol.s; 
+          for (unsigned i = 0; i < sol.attenuation_v_F.size(); i++) 
+            base[(kAtten + i) * stride + k] = sol.attenuation_v_F[i].second; 
+        } 
+      } 
+    } 
+
+    delete [] found; 
+    delete rt; 
+  } 
+
+
+  double RayTable::get(Branch b, int q, double zz, double dd) const
+  { 
+    double fz = (zz - zmin_) / (zmax_ - zmin_) * (nz_-1); 
+    double fd = dd / dmax_ * (nd_-1); 
+    if (!(fz >= 0 && fz <= nz_-1 && fd >= 0 && fd <= nd_-1)) return NAN; 
+
+    int iz = std::min((int) fz, nz_-2); 
+    int id = std::min((int) fd, nd_-2); 
+    double wz = fz - iz; 
+    double wd = fd - id; 
+
+    const double * v = data(b,q) + (size_t) iz * nd_ + id; 
+    return (1-wz) * ((1-wd) * v[0] + wd * v[1]) + wz * ((1-wd) * v[nd_] + wd * v[nd_+1]); 
+  } 
+
+
+  GridInterpolator2D * RayTable::makeInterpolator(Branch b, int q, bool fallback, double fill) const
+  { 
+    const double * v = data(b,q); 
+    const double * other = data(b == kDirect ? kRefracted : kDirect, q); 
+    std::vector<double> vals(v, v + (size_t) nz_ * nd_); 
+    for (size_t i = 0; i < vals.size(); i++) 
+    { 
+      if (std::isnan(vals[i])) vals[i] = fallback && !std::isnan(other[i]) ? other[i] : fill; 
+    } 
+
+    return new GridInterpolator2D(nd_, 0, dmax_, nz_, zmin_, zmax_, &vals[0], GridInterpolator2D::Bilinear); 
+  } 
+
+  GridInterpolator2D * RayTable::makeView(Branch b, int q) const
+  { 
+    return GridInterpolator2D::makeView(nd_, 0, dmax_, nz_, zmin_, zmax_, data(b,q)); 
+  } 
+
+
+  int RayTable::save(const char * file) const
+  { 
+    //a temporary of our own next to file (so the rename stays on one filesystem), which other writers can't collide with 
+    std::string tmp = std::string(file) + ".XXXXXX"; 
+    int fd = mkstemp(&tmp[0]); 
+    FILE * f = fd < 0 ? 0 : fdopen(fd, "wb"); 
+    if (!f) 
+    { 
+      log::out(log::LOG_ERROR, "RayTable: could not create a temporary file for %s\n", file); 
+      if (fd >= 0) 
+      { 
+        close(fd); 
+        unlink(tmp.c_str()); 
+      } 
+      return 1; 
+    } 
+    fchmod(fd, 0644); //mkstemp makes it private to us 
+
+    size_t ndata = (size_t) kNBranches * nq_ * grid_stride_; 
+
+    std::vector<char> hdr_block(header_size, 0); 
+    table_header_t * hdr = (table_header_t *) &hdr_block[0]; 
+    memcpy(hdr->magic, table_magic, sizeof(hdr->magic)); 
+    hdr->version = table_version; 
+    hdr->nq = nq_; 
+    hdr->key = key_; 
+    hdr->nz = nz_; 
+    hdr->nd = nd_; 
+    hdr->zmin = zmin_; 
+    hdr->zmax = zmax_; 
+    hdr->dmax = dmax_; 
+    hdr->z0 = z0_; 
+    hdr->data_offset = header_size; 
+    hdr->grid_stride = grid_stride_; 
+    hdr->file_size = header_size + ndata * sizeof(double); 
+
+    bool ok = fwrite(&hdr_block[0], header_size, 1, f) == 1 &&
+              fwrite(base_, sizeof(double), ndata, f) == ndata; 
+    //the data have to be on disk before the rename, or a crash could leave file pointing at a partial table 
+    ok = ok && fflush(f) == 0 && fsync(fd) == 0; 
+    ok = (fclose(f) == 0) && ok; 
+    ok = ok && rename(tmp.c_str(), file) == 0; 
+
+    if (!ok) 
+    { 
+      log::out(log::LOG_ERROR, "RayTable: problem writing %s\n", file); 
+      unlink(tmp.c_str()); 
+      return 1; 
+    } 
+    return 0; 
+  } 
+
+
+  RayTable * RayTable::load(const char * file, const ice::Model & ice, double z0,
+                            int nz, double zmin, double zmax, int nd, double dmax, const Options & opt) 
+  { 
+    int fd = open(file, O_RDONLY); 
+    if (fd < 0) return 0; 
+
+    struct stat st; 
+    if (fstat(fd, &st) || (size_t) st.st_size < header_size) 
+    { 
+      log::out(log::LOG_WARN, "RayTable: %s is not a ray table\n", file); 
+      close(fd); 
+      return 0; 
+    } 
+
+    size_t len = st.st_size; 
+    void * map = mmap(0, len, PROT_READ, MAP_SHARED, fd, 0); 
+    close(fd); // the mapping stays valid 
+    if (map == MAP_FAILED) 
+    { 
+      log::out(log::LOG_ERROR, "RayTable: could not map %s\n", file); 
+      return 0; 
+    } 
+
+    const table_header_t * hdr = (const table_header_t *) map; 
+    uint64_t key = computeKey(ice, z0, nz, zmin, zmax, nd, dmax, opt); 
+    size_t nq = kAtten + opt.atten_fs.size(); 
+    if (memcmp(hdr->magic, table_magic, sizeof(hdr->magic)) || hdr->version != table_version || hdr->key != key
+        || hdr->nz != nz || hdr->nd != nd || hdr->nq != nq
+        || hdr->data_offset % (grid_align * sizeof(double)) || hdr->grid_stride < (size_t) nz * nd
+        || hdr->file_size != len || hdr->data_offset + kNBranches * nq * hdr->grid_stride * sizeof(double) > len) 
+    { 
+      log::out(log::LOG_INFO, "RayTable: %s does not match the requested table\n", file); 
+      munmap(map, len); 
+      return 0; 
+    } 
+
+    RayTable * t = new RayTable; 
+    t->nz_ = hdr->nz; 
+    t->nd_ = hdr->nd; 
+    t->nq_ = hdr->nq; 
+    t->zmin_ = hdr->zmin; 
+    t->zmax_ = hdr->zmax; 
+    t->dmax_ = hdr->dmax; 
+    t->z0_ = hdr->z0; 
+    t->key_ = hdr->key; 
+    t->grid_stride_ = hdr->grid_stride; 
+    t->map_ = map; 
+    t->map_len_ = len; 
+    t->base_ = (const double *) ((const char *) map + hdr->data_offset); 
+
+    return t; 
+  } 
+
+
+  RayTable * RayTable::make(const char * file, const ice::Model & ice, double z0,
+                            int nz, double zmin, double zmax, int nd, double dmax,
+                            const Options & opt, int nthreads) 
+  { 
+    RayTable * t = file ? load(file, ice, z0, nz, zmin, zmax, nd, dmax, opt) : 0; 
+    if (t) return t; 
+
+    t = new RayTable(ice, z0, nz, zmin, zmax, nd, dmax, opt, nthreads); 
+    if (file) t->save(file); 
+    return t; 
+  } 
+
+  } 
+} 
@@ -1,7 +1,12 @@
 #include "nurfana/Raytracing.h" 
 #include "nurfana/IceModel.h" 
+#include "nurfana/Consts.h"
+#include "nurfana/Logging.h"
 #include "cubature/cubature.h" 
-#include "TGraph.h" 
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <atomic>
 
 
 namespace nurfana
@@ -10,207 +15,704 @@ namespace nurfana
   namespace raytracer
   {
 
+  /* The integrals are done piecewise between a shallow end za (which may be a turning point) and a deeper end.
+   * To get rid of the inverse square root singularity at turning points, we substitute z = za + w^2.
+   */ 
   struct integrand_aux_t 
   {
     const ice::Model * m; 
+    double alpha;
     double alpha2; 
     bool flat; 
-    bool just_d_d; 
     double R; 
-    const std::vector<double> & atten_fs; 
+    double za; 
+    const std::vector<double> * atten_fs; 
+
+    // scratch space, so the ice model can be evaluated for a whole block of points at once
+    std::vector<double> z; 
+    std::vector<double> n; 
+    std::vector<double> ds; 
+    std::vector<double> L; 
   }; 
 
   static int integrand(unsigned ndim, size_t npt, const double *x, void * aux, 
                        unsigned fdim, double *f) 
   {
-    assert(ndim == 1); //integrating only over z
+    (void) ndim; //integrating only over z
     integrand_aux_t * a= (integrand_aux_t *) aux; 
-    int natt = a->atten_fs.size();
-    assert(fdim == 1 || fdim == 3 + natt); //we calculate time, surface distance, chord length, and attenuation, or just ditsance
-
-    for (int ipt = 0; ipt < npt; ipt++) 
-    {
-      double z = x[ipt]; 
-      double n = a->m->n(z); 
-      double n2 = n*n; 
+    unsigned natt = fdim == 1 ? 0 : fdim - 3; 
 
-      double  d_d, d_s;
+    a->z.resize(npt); 
+    a->n.resize(npt); 
+    a->ds.resize(npt); 
+    for (size_t ipt = 0; ipt < npt; ipt++) a->z[ipt] = a->za + x[ipt] * x[ipt]; 
+    a->m->nMany(npt, &a->z[0], &a->n[0]); 
 
-      if (flat) 
+    //we calculate time, surface distance, chord length, and attenuation, or just distance
+    for (size_t ipt = 0; ipt < npt; ipt++) 
+    {
+      double w = x[ipt]; 
+      double z = a->z[ipt]; 
+      double n = a->n[ipt]; 
+      double q = a->flat ? 1 : 1 + 2*z/a->R; 
+      double denom2 = n*n - a->alpha2 * q; 
+      double * fpt = f + ipt * fdim; 
+
+      // can only happen right at a turning point, where the (substituted) integrand is finite anyway
+      if (denom2 <= 0) 
       {
-        double denom2 = n2-a->alpha2; 
-        double denominv = pow(denom2,-0.5); 
-        double d_d =denom_inv; 
-        double d_s = fdim > 1 ? n * denom_inv : 0; 
+        for (unsigned k = 0; k < fdim; k++) fpt[k] = 0; 
+        a->ds[ipt] = 0; 
+        continue; 
       }
-      else
-      {
 
-        double one_plus_2z_over_R = 2*z/a->R +1; 
-        double denom2 = n2-a->alpha2 * one_plus_2z_over_R; 
-        if (denom2 < 0) return 1; 
-        double denominv = pow(denom2,-0.5); 
-        double d_d = one_plus_2z_over_R * denominv; 
-        double d_s = fdim > 1 ? n * denominv : 0; 
-      }
+      double jac_over_denom = 2*w / sqrt(denom2); 
+      double d_d = a->alpha * q * jac_over_denom; 
 
-      f[ipt] = fdim > 1 ?  n*d_s : d_d; ; 
-      if (fdim > 1) 
+      if (fdim == 1) 
       {
-        f[npts+ipt] = d_d; 
-        f[2*npts+ipt] = d_s; 
-
-        for (int iat = 0; iat < natt; iatt++) 
-          f[(3 + iat)*npts+ipt] = d_s / a->m->attenuation(z, a->atten_fs[iat]);
+        fpt[0] = d_d; 
+        continue; 
       }
+
+      double d_s = n * jac_over_denom; 
+      fpt[0] = n * d_s / C; 
+      fpt[1] = d_d; 
+      fpt[2] = d_s; 
+      a->ds[ipt] = d_s; 
+    }
+
+    if (natt) a->L.resize(npt); 
+    for (unsigned iat = 0; iat < natt; iat++) 
+    {
+      a->m->attenuationMany(npt, &a->z[0], &a->L[0], (*a->atten_fs)[iat]); 
+      for (size_t ipt = 0; ipt < npt; ipt++) f[ipt * fdim + 3 + iat] = a->ds[ipt] / a->L[ipt]; 
     }
-    
+
     return 0; 
   }
 
 
+  Raytracer::Raytracer(const ice::Model & icemodel, double z0, const Options & opt) 
+    : ice_(icemodel), z0_(z0), opt_(opt) 
+  {
+  }
 
-  int IntegratingRaytracer::computeRay(double z, double alpha, double *t, double *d, double *s, double * A, unsigned nturns, const double * turns, double * save_turns) 
+  IntegratingRaytracer::IntegratingRaytracer(const ice::Model & icemodel, double z0, const Options & opt) 
+    : Raytracer(icemodel, z0, opt) 
   {
-    std::vector<double> lower_limits(nturns+1); 
-    std::vector<double> upper_limits(nturns+1); 
+  }
 
-    lower_limits[0] = z0; 
-    upper_limits[nturns] = z; 
+  Raytracer * Raytracer::make(const ice::Model & icemodel, double z0, const Options & opt) 
+  {
+    if (opt.flatEarth() && AnalyticExponentialRaytracer::canHandle(icemodel)) 
+      return new AnalyticExponentialRaytracer(icemodel, z0, opt); 
+    return new IntegratingRaytracer(icemodel, z0, opt); 
+  }
 
-    //figure out where the turns are if they're not provided
-    if (!turns)  
+
+  double Raytracer::maxAlpha(double z) const
+  {
+    double a0 = ice_.n(z0_); 
+    double a1 = ice_.n(z); 
+    if (!opt_.flatEarth()) 
     {
-      bool up = z < z0; 
-      double next_z = z0; 
-      for (int iturn = 0; i turn < nturns; i++) 
+      a0 /= sqrt(1 + 2*z0_/opt_.Rsurface); 
+      a1 /= sqrt(1 + 2*z/opt_.Rsurface); 
+    }
+    return std::min(a0,a1); 
+  }
+
+
+  double Raytracer::findTurningPoint(double alpha, double z) const
+  {
+    const bool flat = opt_.flatEarth(); 
+    auto g = [&](double zz) { double n = ice_.n(zz); return n*n - alpha*alpha * (flat ? 1 : 1 + 2*zz/opt_.Rsurface); }; 
+
+    //reaches the surface
+    if (g(0) >= 0) return 0; 
+
+    //here we just have alpha = n sin theta, so the ice model may know the answer
+    if (flat) 
+    {
+      std::vector<double> depths; 
+      ice_.refractionModel().getDepthsWithN(alpha, depths); 
+      double best = -1; 
+      for (unsigned i = 0; i < depths.size(); i++) 
       {
-        next_z =  findTurningPoint(alpha, next_t, up); 
-        if (save_turns) save_turns[iturn] = next_z; 
-        upper_limits[iturn] = next_z
-        lower_limits[iturn+1] = next_z; 
-        up = != up; 
+        if (depths[i] <= z && depths[i] > best) best = depths[i]; 
       }
-    } 
+      if (best >= 0) return best; 
+    }
+
+    //otherwise bisect, assuming g only changes sign once between the surface and z
+    double lo = 0; 
+    double hi = z; 
+    while (hi - lo > 1e-9 * (1+hi)) 
+    {
+      double mid = 0.5 * (lo + hi); 
+      if (g(mid) < 0) lo = mid; 
+      else hi = mid; 
+    }
+
+    return hi; 
+  }
+
+
+  int IntegratingRaytracer::computeRay(double z, double alpha, unsigned nturns, double *t, double *d, double *s, double * A, double * save_turns) const
+  {
+    if (nturns > 1) return 1; 
+
+    //the pieces, each from a shallow end to a deep end
+    double shallow[2]; 
+    double deep[2]; 
+    int npieces = 0; 
+
+    if (nturns == 0) 
+    {
+      shallow[0] = std::min(z,z0_); 
+      deep[0] = std::max(z,z0_); 
+      npieces = 1; 
+    }
     else
     {
-      for (int iturn = 0; iturn < nturns; i++) 
-      {
-        upper_limits[iturn] = turns[iturn]; 
-        lower_limits[iturn+1] = turns[iturn]; 
-      }
+      double zt = findTurningPoint(alpha, std::min(z,z0_)); 
+      if (save_turns) save_turns[0] = zt; 
+      shallow[0] = zt; 
+      deep[0] = z0_; 
+      shallow[1] = zt; 
+      deep[1] = z; 
+      npieces = 2; 
     }
-      
-    struct integrand_aux_t aux; 
+
+    const bool only_d  = d && !t && !s && !A ; 
+    const unsigned natt = A ? opt_.atten_fs.size() : 0; 
+    const unsigned fdim = only_d ? 1 : 3 + natt; 
+
+    integrand_aux_t aux; 
     aux.m = &ice_; 
+    aux.alpha = alpha; 
     aux.alpha2 = alpha*alpha; 
-    aux.R = opt_.R; 
-    aux.atten_fs = opt.atten_fs;
-    double ans_t =0; 
-    double ans_d=0; 
-    double ans_s = 0; 
-    std::vector<double> ans_A(A ? opt.atten_fs.size() : 0); 
+    aux.flat = opt_.flatEarth(); 
+    aux.R = opt_.Rsurface; 
+    aux.atten_fs = &opt_.atten_fs; 
 
-    bool only_d  = d && !t && !s && !A ; 
+    std::vector<double> total(fdim, 0); 
+    std::vector<double> ans(fdim); 
+    std::vector<double> err(fdim); 
 
-    for (int iturn = 0; iturns < nturns+1; iturn++) 
+    for (int ipiece = 0; ipiece < npieces; ipiece++) 
     {
-      double sign = lower_limits[iturn] < upper_limits[iturn] ? -1 : 1; 
-      std::vector<double> ans(only_d ? 1 : 3 + ans_A.size()); 
-      
-      std::vector<double> err(only_d ? 1 : 3 + ans_A.size()); 
-      int ok = pcubature_v(only_d ? 1 : 3 + ans_A.size(), integrand, &aux, 1, &lower_limits[iturn], &upper_limits[iturn], 0, 1e-2,0, ERROR_INDIVIDUAL, &ans[0],err); 
+      if (deep[ipiece] <= shallow[ipiece]) continue; 
+      aux.za = shallow[ipiece]; 
+      double wmin = 0; 
+      double wmax = sqrt(deep[ipiece] - shallow[ipiece]); 
 
-      if (!ok) return ok; 
+      //a small absolute tolerance, since some things (e.g. d for a vertical ray) are 0
+      if (hcubature_v(fdim, integrand, &aux, 1, &wmin, &wmax, 100000, 1e-9, opt_.rel_tolerance, ERROR_INDIVIDUAL, &ans[0], &err[0])) 
+        return 1; 
 
-      if (only_d) 
+      for (unsigned k = 0; k < fdim; k++) total[k] += ans[k]; 
+    }
+
+    if (only_d) 
+    {
+      *d = total[0]; 
+      return 0; 
+    }
+
+    if (t) *t = total[0]; 
+    if (d) *d = total[1]; 
+    if (s) *s = total[2]; 
+    for (unsigned i = 0; i < natt; i++) A[i] = exp(-total[3+i]); 
+    return 0; 
+  }
+
+
+  bool Raytracer::bracketAlpha(double d, double z, unsigned nturns, AlphaHint * hint, double & lo, double & flo, double & hi, double & fhi) const
+  {
+    //the distance is 0 for a vertical ray, and increases with alpha up to the largest allowed alpha.
+    hi = maxAlpha(z) * (1-1e-12); 
+
+    //the largest distance only depends on the depth, so it's only computed once per depth
+    if (hint && hint->z == z && hint->nturns == nturns) 
+    {
+      fhi = hint->d_max - d; 
+    }
+    else
+    {
+      double dmax = NAN; 
+      if (computeRay(z, hi, nturns, 0, &dmax)) dmax = NAN; 
+      fhi = dmax - d; 
+      if (hint) 
       {
-        ans_d += ans[0] * sign * alpha; 
+        hint->z = z; 
+        hint->nturns = nturns; 
+        hint->d_max = dmax; 
+        hint->alpha = -1; 
+      }
+    }
+
+    if (!(fhi >= 0)) return false;  //shadowed (or something went wrong) 
+
+    lo = 0; 
+    flo = -d; 
+
+    //a previous solution at the same depth is one end of the bracket
+    if (hint && hint->alpha >= 0) 
+    {
+      if (hint->d <= d) 
+      {
+        lo = hint->alpha; 
+        flo = hint->d - d; 
       }
       else
       {
-        ans_t += ans[0]*sign * (1./0.3); 
-        ans_d += ans[1]*sign *alpha; 
-        ans_s += ans[2]*sign; 
-        for (size_t i = 0; i < ans_A.size(); i++) 
-          ans_A[i] += ans[3+i]*sign; 
+        hi = hint->alpha; 
+        fhi = hint->d - d; 
       }
     }
 
-    if (t) *t = ans_t; 
-    if (d) *d = ans_d; 
-    if (s) *s = ans_s; 
-    if (A) memcpy(A,&ans_A[0], sizeof(double) * ans_A.size()); 
-    return 0;
+    return true; 
   }
 
-  struct gsl_root_aux
+
+  double Raytracer::findAlpha(double d, double z, unsigned nturns, AlphaHint * hint) const
   {
-    ice::Model * m; 
-    IntegratingRaytracer::Options *opt; 
-    double alpha;
+    if (nturns > 1) return -1; 
+    if (d <= 0) return 0; 
+
+    auto f = [&](double alpha) -> double
+    {
+      double dd = 0; 
+      if (computeRay(z, alpha, nturns, 0, &dd)) return NAN; 
+      return dd - d; 
+    }; 
+
+    double lo, flo, hi, fhi; 
+    if (!bracketAlpha(d, z, nturns, hint, lo, flo, hi, fhi)) return -1; 
+    if (flo == 0) return lo; 
+
+    //Illinois-style regula falsi, falling back to bisection if it stalls
+    int side = 0; 
+    for (int iter = 0; iter < 200; iter++) 
+    {
+      double x = (lo * fhi - hi * flo) / (fhi - flo); 
+      if (!(x > lo && x < hi)) x = 0.5 * (lo + hi); 
+      double fx = f(x); 
+      if (std::isnan(fx)) return -1; 
+
+      if (fabs(fx) < 1e-7 * (1 + d) || hi - lo < 1e-14) 
+      {
+        if (hint) 
+        { 
+          hint->alpha = x; 
+          hint->d = d + fx; 
+        } 
+        return x; 
+      }
+
+      if (fx < 0) 
+      {
+        lo = x; 
+        flo = fx; 
+        if (side == -1) fhi /= 2; 
+        side = -1; 
+      }
+      else
+      {
+        hi = x; 
+        fhi = fx; 
+        if (side == 1) flo /= 2; 
+        side = 1; 
+      }
+    }
+
+    return 0.5 * (lo + hi); 
+  }
 
-  };
 
-  double IntegratingRaytracer::findTurningPoint(double alpha, double z, bool up, int i = 0) 
+  Solution * Raytracer::solve(double z, double d, const Turns & turns, Solution * solution) const
   {
-    depths_.clear(); 
-    depths.push_back(0); 
-    int nsolns = ice_.refractionMode()->getDepthsWithN(alpha, depths); 
-    depths.push_back(m_.iceDepth()); 
+    return solveHinted(z, d, turns, solution, 0); 
+  }
 
-    std::sort(depths.begin(), depths.end()); 
-    size_t lb = std::lower_bound(depths.begin(), depths.end(), z); 
 
-    //here we just have alpha = n sin theta, so that's good enough
-    if (opt_.flatEarth())
+  size_t Raytracer::solveMany(size_t N, const double * z, const double * d, Solution * solutions, bool * found, const Turns & turns, int nthreads) const
+  {
+    std::vector<size_t> order(N); 
+    for (size_t i = 0; i < N; i++) order[i] = i; 
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return z[a] < z[b] || (z[a] == z[b] && d[a] < d[b]); }); 
+
+    if (nthreads <= 0) nthreads = std::thread::hardware_concurrency(); 
+    if (nthreads <= 0) nthreads = 1; 
+
+    // contiguous chunks of the sorted sources, so that each thread's hint stays useful
+    const size_t chunk = 256; 
+    size_t nchunks = (N + chunk - 1) / chunk; 
+    if (nthreads > (int) nchunks) nthreads = nchunks; 
+
+    std::atomic<size_t> next(0); 
+    std::atomic<size_t> nfound(0); 
+    auto work = [&]() 
     {
-      if (!up)
-        return depths[TMath::Max(0,lb-1-i)]
-      else
-        return depths[TMath::Min(lb+i, depths.size()-1)];
+      AlphaHint hint; 
+      size_t c; 
+      size_t n = 0; 
+      while ( (c = next++) < nchunks) 
+      {
+        size_t end = std::min(N, (c+1) * chunk); 
+        for (size_t i = c * chunk; i < end; i++) 
+        { 
+          size_t k = order[i]; 
+          bool ok = solveHinted(z[k], d[k], turns, &solutions[k], &hint) != 0; 
+          if (found) found[k] = ok; 
+          n += ok; 
+        } 
+      }
+      nfound += n; 
+    }; 
+
+    std::vector<std::thread> threads; 
+    for (int t = 1; t < nthreads; t++) threads.push_back(std::thread(work)); 
+    work(); 
+    for (unsigned t = 0; t < threads.size(); t++) threads[t].join(); 
+
+    return nfound; 
+  }
+
+
+  Solution * Raytracer::solveHinted(double z, double d, const Turns & turns, Solution * solution, AlphaHint * hint) const
+  {
+    unsigned nturns = turns.getNTurns(); 
+    double alpha = findAlpha(d, z, nturns, hint); 
+    if (alpha < 0) return 0; 
+
+    double t, dd, s, tp = 0; 
+    std::vector<double> A(opt_.atten_fs.size()); 
+    if (computeRay(z, alpha, nturns, &t, &dd, &s, A.size() ? &A[0] : 0, &tp)) return 0; 
+
+    if (!solution) solution = new Solution; 
+
+    const bool flat = opt_.flatEarth(); 
+    auto sin_theta = [&](double zz) { return std::min(1., alpha * (flat ? 1 : sqrt(1+2*zz/opt_.Rsurface)) / ice_.n(zz)); }; 
+    double th0 = asin(sin_theta(z0_)); 
+    double th1 = asin(sin_theta(z)); 
+
+    bool up0 = nturns == 1 || z < z0_; 
+    bool up1 = nturns == 0 && z < z0_; 
+
+    solution->z0 = z0_; 
+    solution->z1 = z; 
+    solution->theta0 = up0 ? th0 : M_PI - th0; 
+    solution->theta1 = up1 ? th1 : M_PI - th1; 
+    solution->t = t; 
+    solution->s = s; 
+    solution->d = dd; 
+    solution->phi = flat ? 0 : dd / opt_.Rsurface; 
+    solution->alpha = alpha; 
+    solution->turns = turns; 
+    solution->turning_points.clear(); 
+    if (nturns) solution->turning_points.push_back(tp); 
+    solution->attenuation_v_F.clear(); 
+    for (unsigned i = 0; i < A.size(); i++) solution->attenuation_v_F.push_back(std::pair<double,double>(opt_.atten_fs[i], A[i])); 
+    solution->opt = opt_; 
+
+    return solution; 
+  }
+
+
+  /* Gauss-Legendre nodes and weights on [-1,1], for the attenuation integral when it can't be done in closed form */ 
+  struct gauss_legendre_t
+  {
+    enum { N = 16 }; 
+    double x[N]; 
+    double w[N]; 
+
+    gauss_legendre_t() 
+    {
+      for (int i = 0; i < N; i++) 
+      {
+        double z = cos(M_PI * (i + 0.75) / (N + 0.5)); 
+        double dp = 1; 
+        for (int iter = 0; iter < 100; iter++) 
+        { 
+          double p0 = 1, p1 = 0; 
+          for (int j = 0; j < N; j++) 
+          { 
+            double p2 = p1; 
+            p1 = p0; 
+            p0 = ((2*j + 1) * z * p1 - j * p2) / (j + 1); 
+          } 
+          dp = N * (z * p0 - p1) / (z*z - 1); 
+          double dz = p0 / dp; 
+          z -= dz; 
+          if (fabs(dz) < 1e-15) break; 
+        } 
+        x[i] = z; 
+        w[i] = 2 / ((1 - z*z) * dp * dp); 
+      }
+    }
+  }; 
+
+  static const gauss_legendre_t & gauss_legendre() 
+  {
+    static const gauss_legendre_t gl; 
+    return gl; 
+  }
+
+
+  /* The antiderivatives (in z) of the distance, path length and time for n = A - a1 exp(-b z).
+   *
+   * With u = exp(-bz), n^2 - alpha^2 = p u^2 + q u + c, with p = a1^2, q = -2 A a1 and c = A^2 - alpha^2 (> 0 for any usable alpha).
+   */ 
+  struct exp_ray_t
+  {
+    double A, a1, b, alpha, q, c, sqrtc; 
+
+    exp_ray_t(double AA, double aa1, double bb, double al) 
+      : A(AA), a1(aa1), b(bb), alpha(al), q(-2*AA*aa1), c(AA*AA - al*al), sqrtc(sqrt(AA*AA-al*al)) { } 
+
+    void eval(double z, bool only_d, double * D, double * S, double * T) const
+    {
+      double u = exp(-b*z); 
+      double n = A - a1 * u; 
+      double R = std::max(0., n*n - alpha*alpha); 
+      double sR = sqrt(R); 
+
+      double I1 = -::log((2*c + q*u + 2*sqrtc*sR)/u) / sqrtc; 
+      *D = -alpha * I1 / b; 
+      if (only_d) return; 
+
+      double I2 = -::log(n + sR) / a1; 
+      double I3 = sR + 0.5 * q * I2 + c * I1; 
+      *S = -(A * I1 - a1 * I2) / b; 
+      *T = -(I3 + alpha*alpha * I1) / (b * C); 
+    }
+  }; 
+
+
+  bool AnalyticExponentialRaytracer::canHandle(const ice::Model & m, double * a0, double * a1, double * b) 
+  {
+    double aa0, aa1, bb; 
+    const ice::RefractionModel * r = &m.refractionModel(); 
+
+    if (const ice::ExponentialRefractionModel * e = dynamic_cast<const ice::ExponentialRefractionModel*>(r)) 
+    {
+      aa0 = e->a0(); 
+      aa1 = e->a1(); 
+      bb = e->b1(); 
+    }
+    else if (const ice::DensityDerivedRefractionModel * dd = dynamic_cast<const ice::DensityDerivedRefractionModel*>(r)) 
+    {
+      const ice::ExponentialDensityModel * e = dynamic_cast<const ice::ExponentialDensityModel*>(&dd->densityModel()); 
+      if (!e) return false; 
+      //must match DensityDerivedRefractionModel::n
+      aa0 = 1 + 0.845 * e->a0(); 
+      aa1 = 0.845 * e->a1(); 
+      bb = e->b1(); 
+    }
+    else
+    {
+      return false; 
+    }
+
+    if (!(aa1 > 0 && bb > 0)) return false; 
+    if (a0) *a0 = aa0; 
+    if (a1) *a1 = aa1; 
+    if (b) *b = bb; 
+    return true; 
+  }
+
+
+  AnalyticExponentialRaytracer::AnalyticExponentialRaytracer(const ice::Model & icemodel, double z0, const Options & opt) 
+    : Raytracer(icemodel, z0, opt), atten_length_(0) 
+  {
+    double a0 = 0; 
+    ok_ = canHandle(icemodel, &a0, &a1_, &b_); 
+    A_ = a0 + a1_; 
+    if (!ok_) 
+    {
+      log::out(log::LOG_ERROR, "AnalyticExponentialRaytracer: ice model %s does not have an exponential profile\n", icemodel.GetName()); 
+    }
+
+    if (!opt_.flatEarth()) 
+    {
+      log::out(log::LOG_DEBUG, "AnalyticExponentialRaytracer: ignoring the Earth's curvature\n"); 
+      opt_.Rsurface = 0; 
+    }
+
+    if (const ice::ConstantAttenuationModel * att = dynamic_cast<const ice::ConstantAttenuationModel*>(&icemodel.attenuationModel())) 
+    {
+      atten_length_ = att->length(); 
     }
+  }
+
 
+  double AnalyticExponentialRaytracer::maxAlpha(double z) const
+  {
+    //n increases with depth, so the shallower end limits alpha
+    double zz = std::max(0., std::min(z, z0_)); 
+    return A_ - a1_ * exp(-b_*zz); 
+  }
 
-    //otherwise, this gets a bit trickier. We'll use the flat Earth solution as a guess
-    //and use a root-finder to get the real answer. 
-    /
-    gsl_function F; 
 
-    F.function = [](double z, void * p)
+  double AnalyticExponentialRaytracer::findTurningPoint(double alpha, double z) const
+  {
+    // reaches the surface
+    if (alpha <= A_ - a1_) return 0; 
+    double zt = -::log((A_ - alpha)/a1_) / b_; 
+    return std::min(zt, z); 
+  }
+
+
+  int AnalyticExponentialRaytracer::computeRay(double z, double alpha, unsigned nturns, double *t, double *d, double *s, double * A, double * save_turns) const
+  {
+    if (!ok_ || nturns > 1) return 1; 
+    if (!(alpha >= 0 && alpha < A_)) return 1; 
+
+    double shallow[2]; 
+    double deep[2]; 
+    int npieces = 0; 
+
+    if (nturns == 0) 
     {
-      gsl_root_aux * aux = (gsl_root_aux*) p; 
-      return (1 - z / aux->opt.Rsurface) * aux.ice->refraction(z) - aux->alpha; 
+      shallow[0] = std::min(z,z0_); 
+      deep[0] = std::max(z,z0_); 
+      npieces = 1; 
+    }
+    else
+    {
+      double zt = findTurningPoint(alpha, std::min(z,z0_)); 
+      if (save_turns) save_turns[0] = zt; 
+      shallow[0] = zt; 
+      deep[0] = z0_; 
+      shallow[1] = zt; 
+      deep[1] = z; 
+      npieces = 2; 
     }
 
-    gsl_root_aux aux{.m=&m_, .opt=&opt_, .alpha = alpha}; 
-    F.aux = &aux; 
-    j
+    const bool only_d = !t && !s && !A; 
+    const unsigned natt = A ? opt_.atten_fs.size() : 0; 
+    exp_ray_t ray(A_, a1_, b_, alpha); 
 
-    double val = F.function(z); 
+    double DD = 0, SS = 0, TT = 0; 
+    std::vector<double> att(natt, 0); 
 
-    
+    for (int ipiece = 0; ipiece < npieces; ipiece++) 
+    {
+      if (deep[ipiece] <= shallow[ipiece]) continue; 
+
+      double D0, S0 = 0, T0 = 0; 
+      double D1, S1 = 0, T1 = 0; 
+      ray.eval(shallow[ipiece], only_d, &D0, &S0, &T0); 
+      ray.eval(deep[ipiece], only_d, &D1, &S1, &T1); 
+      DD += D1 - D0; 
+      SS += S1 - S0; 
+      TT += T1 - T0; 
+
+      if (!natt || atten_length_ > 0) continue; 
+
+      // ds / L, with z = za + w^2 to take care of the turning point, as in IntegratingRaytracer
+      const gauss_legendre_t & gl = gauss_legendre(); 
+      double half = 0.5 * sqrt(deep[ipiece] - shallow[ipiece]); 
+      double zz[gauss_legendre_t::N]; 
+      double ds[gauss_legendre_t::N]; 
+      double L[gauss_legendre_t::N]; 
+      for (int k = 0; k < gauss_legendre_t::N; k++) 
+      {
+        double w = half * (1 + gl.x[k]); 
+        zz[k] = shallow[ipiece] + w*w; 
+        double n = A_ - a1_ * exp(-b_*zz[k]); 
+        double R = n*n - alpha*alpha; 
+        ds[k] = R <= 0 ? 0 : n * 2 * w / sqrt(R) * half * gl.w[k]; 
+      }
 
+      for (unsigned i = 0; i < natt; i++) 
+      {
+        ice_.attenuationMany(gauss_legendre_t::N, zz, L, opt_.atten_fs[i]); 
+        for (int k = 0; k < gauss_legendre_t::N; k++) att[i] += ds[k] / L[k]; 
+      }
+    }
 
-    
+    if (d) *d = DD; 
+    if (only_d) return 0; 
+    if (t) *t = TT; 
+    if (s) *s = SS; 
+    for (unsigned i = 0; i < natt; i++) A[i] = exp(atten_length_ > 0 ? -SS / atten_length_ : -att[i]); 
+    return 0; 
   }
 
-    double IntegratingRaytracer::computeAlpha(double d, double z, unsigned nturns, const double * turning_points) 
+
+  double AnalyticExponentialRaytracer::findAlpha(double d, double z, unsigned nturns, AlphaHint * hint) const
+  {
+    if (!ok_ || nturns > 1) return -1; 
+    if (d <= 0) return 0; 
+
+    auto f = [&](double alpha) -> double
     {
-      //so we know how to solve the for d given alpha
+      double dd = 0; 
+      if (computeRay(z, alpha, nturns, 0, &dd)) return NAN; 
+      return dd - d; 
+    }; 
 
+    double lo, flo, hi, fhi; 
+    if (!bracketAlpha(d, z, nturns, hint, lo, flo, hi, fhi)) return -1; 
+    if (flo == 0) return lo; 
 
+    double x; 
+    if (lo > 0 || hi < maxAlpha(z) * (1-1e-12)) 
+    {
+      //a neighbor's solution gave a tight bracket, so interpolate in it
+      x = (lo * fhi - hi * flo) / (fhi - flo); 
+    }
+    else
+    {
+      //start direct rays from the straight line, which is usually close
+      double dz = fabs(z - z0_); 
+      x = nturns ? 0.5 * (lo + hi) : maxAlpha(z) * d / sqrt(d*d + dz*dz); 
     }
+    if (!(x > lo && x < hi)) x = 0.5 * (lo + hi); 
 
+    for (int iter = 0; iter < 100; iter++) 
+    {
+      double fx = f(x); 
+      if (std::isnan(fx)) return -1; 
+      if (fabs(fx) < 1e-9 * (1 + d) || hi - lo < 1e-15) 
+      {
+        if (hint) 
+        { 
+          hint->alpha = x; 
+          hint->d = d + fx; 
+        } 
+        return x; 
+      }
 
+      if (fx < 0) lo = x; 
+      else hi = x; 
 
-    Options defaultOpts; 
-    const Options & Options::defaultOptions() { return defaultOpts; } 
+      // the derivative is cheap enough to do numerically. It blows up near the largest alpha, which the bracket deals with.
+      double h = 1e-7 * (hi - lo); 
+      double fp = (f(x+h) - fx) / h; 
 
+      double xn = x - fx / fp; 
+      if (!(xn > lo && xn < hi)) xn = 0.5 * (lo + hi); 
+      x = xn; 
+    }
 
+    return x; 
+  }
 
 
+
+  const Turns & Turns::turnsWithNoSkip(unsigned i) 
+  {
+    static const Turns turns[] = { Turns(0), Turns(1), Turns(2), Turns(3) }; 
+    return turns[std::min(i, 3u)]; 
   }
-}
 
+  static Options defaultOpts; 
+  const Options & Options::defaultOptions() { return defaultOpts; } 
 
+  }
+}
@@ -2,6 +2,7 @@
 #include "nurfana/FrequencyRepresentation.h" 
 #include "nurfana/FFT.h" 
 #include "nurfana/Logging.h"  
+#include "nurfana_simd.h" 
 
 #include "TGraph.h" 
 #include "TH1.h" 
@@ -12,7 +13,7 @@ namespace nurfana
 
   size_t TimeRepresentation::lower_bound(double t, size_t start) const 
   {
-    return std::lower_bound(t_.begin()+start, t_.end(), t) - (t_.begin() + start); 
+    return std::lower_bound(t_.begin()+std::min(start, t_.size()), t_.end(), t) - t_.begin(); 
   }
 
 
@@ -20,6 +21,7 @@ namespace nurfana
   {
     delete interp_; 
     interp_ = Interpolator::make(t,opt); 
+    interp_->setInput(this); 
   }
 
 
@@ -27,6 +29,7 @@ namespace nurfana
     : TNamed("time", "Time Representation") 
   {
     interp_ = Interpolator::make(); 
+    interp_->setInput(this); 
   }
 
   /* Note that this does NOT copy t_ or y_because we don't want to do that in the even case necessarily */
@@ -34,6 +37,7 @@ namespace nurfana
     : TNamed(other), TAttLine(other), TAttMarker(other), TAttFill(other)
   {
     interp_ = Interpolator::copy(*other.interp_); 
+    interp_->setInput(this); 
   }
 
   TimeRepresentation & TimeRepresentation::operator=(const TimeRepresentation &other) 
@@ -42,7 +46,14 @@ namespace nurfana
     TAttLine::operator=(other); 
     TAttMarker::operator=(other); 
     TAttFill::operator=(other); 
-    interp_ = Interpolator::copy(*other.interp_); 
+
+    //keep our interpolator if it's already the right kind. Either way, our samples are about to change. 
+    if (other.interp_ && (!interp_ || interp_->type() != other.interp_->type() || interp_->opt() != other.interp_->opt()))
+    {
+      delete interp_; 
+      interp_ = Interpolator::copy(*other.interp_); 
+    }
+    invalidate(); 
     return *this; 
   }
 
@@ -52,6 +63,7 @@ namespace nurfana
     : TNamed (other), TAttLine(other), TAttMarker(other), TAttFill(other)
   {
     interp_ = Interpolator::make(); 
+    interp_->setInput(this); 
   }
 
   TimeRepresentation & TimeRepresentation::operator=(const FrequencyRepresentation &other) 
@@ -60,6 +72,7 @@ namespace nurfana
     TAttLine::operator=(other); 
     TAttMarker::operator=(other); 
     TAttFill::operator=(other); 
+    invalidate(); 
     return *this; 
   }
 
@@ -69,6 +82,7 @@ namespace nurfana
   {
     interp_ = other.interp_; 
     other.interp_ = 0; 
+    if (interp_) interp_->setInput(this); 
   }
 
 
@@ -114,39 +128,14 @@ namespace nurfana
 
   double TimeRepresentation::getPeak(unsigned * index, int start, int end, bool abs) const
   {
-    if ( start < 0) start += N(); 
-    if ( end < 0) start += N(); 
-
-    double max = 0; 
-    int imax = 0; 
-
-    for (int i = start; i <= end; i++) 
-    {
-      double V = abs ? fabs(y(i)) : y(i); 
-      if ( V > max) 
-      {
-        max = V; 
-        imax = i; 
-      }
-    }
-
-    if (index) *index = imax; 
-    return max; 
+    Stats st = getStats(start, end, abs); 
+    if (index) *index = st.peak_index; 
+    return st.peak; 
   }
 
   double TimeRepresentation::getSumV2(int start , int end )  const
   {
-    if ( start < 0) start += N(); 
-    if ( end < 0) start += N(); 
-
-    double V2 = 0; 
-    for (int i = start; i <= end; i++) 
-    {
-      double V = y(i); 
-      V2 += V*V; 
-    }
-
-    return V2; 
+    return getStats(start,end).sum2; 
   }
 
   double TimeRepresentation::getRMS(int start, int end)  const
@@ -157,42 +146,59 @@ namespace nurfana
 
   double TimeRepresentation::getMean(int start, int end)  const
   {
-    if ( start < 0) start += N(); 
-    if ( end < 0) start += N(); 
+    return getStats(start,end).sum/N(); 
+  }
 
-    double sum = 0; 
+  TimeRepresentation::Stats TimeRepresentation::getStats(int start, int end, bool use_abs) const
+  {
+    int n = N(); 
+    if ( start < 0) start += n; 
+    if ( end < 0) end += n; 
 
-    for (int i = start; i <= end; i++) 
-    {
-      sum += y(i); 
-    }
+    simd::stats_t st; 
+    simd::stats(end >= start ? end - start + 1 : 0, y() + start, use_abs, &st); 
 
-    return sum/N(); 
+    Stats ans; 
+    ans.peak = st.max; 
+    //nothing above 0 gives index 0, not start, as getPeak always has 
+    ans.peak_index = st.max > 0 ? start + st.imax : 0; 
+    ans.sum = st.sum; 
+    ans.sum2 = st.sum2; 
+    ans.mean = end >= start ? st.sum / (end - start + 1) : 0; 
+    return ans; 
   }
 
 
   TimeRepresentation & TimeRepresentation::operator*(double x)
   {
-    for (unsigned i = 0; i < N(); i++) y_[i] *=x; 
+    size_t n = N(); 
+    double * yy = updateY(); 
+    for (size_t i = 0; i < n; i++) yy[i] *=x; 
     return *this; 
   }
 
   TimeRepresentation & TimeRepresentation::operator-(double x)
   {
-    for (unsigned i = 0; i < N(); i++) y_[i] -=x; 
+    size_t n = N(); 
+    double * yy = updateY(); 
+    for (size_t i = 0; i < n; i++) yy[i] -=x; 
     return *this; 
   }
 
   TimeRepresentation & TimeRepresentation::operator+(double x)
   {
-    for (unsigned i = 0; i < N(); i++) y_[i] +=x; 
+    size_t n = N(); 
+    double * yy = updateY(); 
+    for (size_t i = 0; i < n; i++) yy[i] +=x; 
     return *this; 
   }
 
   TimeRepresentation & TimeRepresentation::operator/(double x)
   {
     double inv = 1./x; 
-    for (unsigned i = 0; i < N(); i++) y_[i] *=inv; 
+    size_t n = N(); 
+    double * yy = updateY(); 
+    for (size_t i = 0; i < n; i++) yy[i] *=inv; 
     return (*this); 
   }
 
@@ -226,7 +232,7 @@ namespace nurfana
   UnevenRepresentation & UnevenRepresentation::operator=(const EvenRepresentation & even) 
   {
     TimeRepresentation::operator=(even); 
-    y_.insert(y_.end(), even.y(), even.y() + even.N()); 
+    y_.assign(even.y(), even.y() + even.N()); 
     t_.resize(N()); 
     even.fillT(&t_[0]); 
     nominal_dt_ = even.dt(); 
@@ -280,6 +286,15 @@ namespace nurfana
     y_.insert(y_.end(), y, y + N); 
   }
 
+  void EvenRepresentation::set(size_t N, const double *y, double dt, double t0) 
+  {
+    t0_ = t0; 
+    dt_ = dt; 
+    y_.assign(y, y + N); 
+    t_dirty_ = true; 
+    invalidate(); 
+  }
+
   EvenRepresentation::EvenRepresentation(const UnevenRepresentation & u, double dt) 
     : TimeRepresentation(u), t_dirty_(true) 
   {
@@ -297,7 +312,10 @@ namespace nurfana
     }
     else
     {
-      interp_->evalMany(n, t(), updateY()); 
+      //resample u with our interpolator (the same type as u's), then point it back at ourselves. (updateY would do that too early.) 
+      interp_->setInput(&u); 
+      interp_->evalEven(n, t0_, dt_, &y_[0]); 
+      interp_->setInput(this); 
     }
   }
 
@@ -322,7 +340,9 @@ namespace nurfana
     }
     else
     {
-      interp_->evalMany(n, t(), updateY()); 
+      interp_->setInput(&u); 
+      interp_->evalEven(n, t0_, dt_, &y_[0]); 
+      interp_->setInput(this); 
     }
  
     return *this; 
@@ -350,7 +370,7 @@ namespace nurfana
     TimeRepresentation::operator=(copy); 
     t0_ = copy.t0(); 
     dt_ = copy.dt(); 
-    y_.insert(y_.begin(),copy.y(), copy.y()+copy.N()); 
+    y_.assign(copy.y(), copy.y()+copy.N()); 
     t_dirty_ = true; 
     return *this; 
   }
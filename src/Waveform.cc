@@ -2,6 +2,7 @@
 #include "nurfana/SignalOps.h" 
 #include <assert.h> 
 #include "nurfana_private.h" 
+#include "nurfana_simd.h" 
 
 
 #define ZERO() hilbert_ = 0; envelope_ = 0;
@@ -70,6 +71,38 @@ namespace nurfana
   }
 
 
+  //Copying 
+  Waveform::Waveform(const Waveform & other) 
+    : TNamed(other), TAttLine(other), TAttMarker(other), TAttFill(other) 
+  {
+    ZERO(); 
+    *this = other; 
+  }
+
+  Waveform & Waveform::operator=(const Waveform & other) 
+  {
+    if (this == &other) return *this; 
+
+    TNamed::operator=(other); 
+    TAttLine::operator=(other); 
+    TAttMarker::operator=(other); 
+    TAttFill::operator=(other); 
+
+    //only copy the representations that are actually valid 
+    even_dirty_ = other.even_dirty_; 
+    uneven_dirty_ = other.uneven_dirty_; 
+    freq_dirty_ = other.freq_dirty_; 
+    if (!even_dirty_) even_ = other.even_; 
+    if (!uneven_dirty_) uneven_ = other.uneven_; 
+    if (!freq_dirty_) freq_ = other.freq_; 
+
+    //our hilbert_ and envelope_ (if any) get reused next time they're needed 
+    hilbert_dirty_ = true; 
+    envelope_dirty_ = true; 
+    return *this; 
+  }
+
+
   const Waveform & Waveform::hilbertTransform() const 
   {
     if (hilbert_dirty_) 
@@ -78,6 +111,7 @@ namespace nurfana
       {
         FrequencyRepresentation * fr = ops::doHilbertTransform(&freq()); 
         hilbert_ = new Waveform(std::move(*fr)); 
+        delete fr; 
       }
       else
       {
@@ -94,16 +128,26 @@ namespace nurfana
 
     if (envelope_dirty_) 
     {
-      if (!envelope_) envelope_ = new EvenRepresentation(even()); 
-
-      envelope_->resize(even().N()); 
-
-      auto hil = hilbertTransform(); 
-      auto Y = envelope_->updateY(); 
-      for (unsigned i = 0; i < even().N(); i++) 
-      {
-        Y[i] = sqrt(pow(even()[i],2) + pow(hil.even()[i],2)); 
-      }
+      const EvenRepresentation & x = even(); 
+      const FrequencyRepresentation & X = freq(); 
+      size_t N = X.Nt(); 
+
+      if (!envelope_) envelope_ = new EvenRepresentation(x); 
+      envelope_->resize(N); 
+      envelope_->setDT(x.dt()); 
+      envelope_->setT0(x.t0()); 
+
+      // Only the imaginary part of the analytic signal x + iH(x) needs transforming, since we have x already. 
+      // It is done straight into the envelope's samples, which then become the magnitude in place. 
+      static thread_local fft::aligned_vector<std::complex<double> > H; 
+      H.resize(X.Nf()); 
+      const std::complex<double> * Y = X.Y(); 
+      for (size_t i = 0; i < X.Nf(); i++) H[i] = std::complex<double>(-Y[i].imag(), Y[i].real()); //as in ops::doHilbertTransform 
+
+      double * env = envelope_->updateY(); 
+      fft::inverse(N, &H[0], env); 
+
+      simd::magnitude(N, x.y(), env, env); 
       envelope_dirty_ = false; 
     }
 
@@ -187,6 +231,12 @@ namespace nurfana
      return even_; 
   }
 
+  void Waveform::setEven(size_t N, const double * y, double dt, double t0) 
+  {
+    even_.set(N, y, dt, t0); 
+    SET_EVEN(); 
+  }
+
   const EvenRepresentation & Waveform::even() const 
   {
     prepareEven(); 
@@ -3,6 +3,9 @@
 
 #include <string.h> 
 #include "TString.h" 
+#include <vector> 
+#include <thread> 
+#include <atomic> 
 
 /** Private utility methods, not exported */ 
 namespace nurfana
@@ -82,6 +85,30 @@ namespace nurfana
 
  
 
+    /** Runs fn(i) for 0 <= i < n, spread over nthreads threads */ 
+    template <typename F>
+    inline void parallel_for(size_t n, int nthreads, F fn) 
+    { 
+      if (nthreads > (int) n) nthreads = n; 
+      if (nthreads <= 1) 
+      { 
+        for (size_t i = 0; i < n; i++) fn(i); 
+        return; 
+      } 
+
+      std::atomic<size_t> next(0); 
+      auto work = [&]() 
+      { 
+        size_t i; 
+        while ( (i = next++) < n) fn(i); 
+      }; 
+
+      std::vector<std::thread> threads; 
+      for (int t = 1; t < nthreads; t++) threads.push_back(std::thread(work)); 
+      work(); 
+      for (unsigned t = 0; t < threads.size(); t++) threads[t].join(); 
+    }
+
 }
 
 #endif
@@ -0,0 +1,559 @@
+#ifndef _nurfana_simd_h
+#define _nurfana_simd_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/* Runtime dispatch needs __builtin_cpu_supports and the target attribute (avx512f, and intrinsics without -m flags, from gcc 5) */
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || __GNUC__ >= 5)
+#define NURFANA_SIMD_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+/** Private SIMD helpers, not exported.
+ *
+ * These use the GCC vector extensions (also understood by clang), so they turn into
+ * whatever vector instructions -march allows, regardless of the optimization level.
+ * Vector types are only used for locals, so nothing depends on the vector ABI.
+ *
+ * Without AVX, 4-wide vectors have to be emulated and end up slower than libm, so there the plain loop is used.
+ *
+ * Functions that are worth it on every machine the library may run on (rather than the one it was built on)
+ * are instead compiled for several targets and dispatched at runtime. Those use intrinsics where the vector
+ * extensions have nothing equivalent (e.g. sqrt).
+ */
+namespace nurfana
+{
+  namespace simd
+  {
+#ifdef __AVX__
+    typedef double v4d __attribute__((vector_size(32)));
+    typedef int64_t v4l __attribute__((vector_size(32)));
+#endif
+
+#define NURFANA_V4D(x) { (x), (x), (x), (x) }
+
+    /** out[i] = a + b * exp(c * z[i]), good to about 1 ulp in the exponential. out may alias z.
+     * This is what the exponential ice models need. */
+    inline void affine_exp(size_t N, const double * z, double * out, double a, double b, double c)
+    {
+#ifndef __AVX__
+      for (size_t i = 0; i < N; i++) out[i] = a + b * exp(c * z[i]);
+#else
+      const v4d va = NURFANA_V4D(a);
+      const v4d vb = NURFANA_V4D(b);
+      const v4d log2e = NURFANA_V4D(1.4426950408889634);
+      const v4d ln2hi = NURFANA_V4D(6.93147180369123816490e-01);
+      const v4d ln2lo = NURFANA_V4D(1.90821492927058770002e-10);
+      const v4d shifter = NURFANA_V4D(6755399441055744.0); // 1.5 * 2^52, so the low bits of x/ln2 + shifter hold round(x/ln2)
+      const v4l bias = NURFANA_V4D(1023);
+      const v4l mantissa_bits = NURFANA_V4D(52);
+
+      const v4d vc = NURFANA_V4D(c);
+      const v4d xmin = NURFANA_V4D(-708.);
+      const v4d xmax = NURFANA_V4D(708.);
+
+      for (size_t i = 0; i < N; i += 4)
+      {
+        size_t n = N - i < 4 ? N - i : 4;
+        double buf[4] = { 0, 0, 0, 0 };
+        v4d x;
+        if (n == 4) memcpy(&x, z + i, sizeof(x));
+        else
+        {
+          for (size_t j = 0; j < n; j++) buf[j] = z[i+j];
+          memcpy(&x, buf, sizeof(x));
+        }
+
+        x *= vc;
+        x = x < xmin ? xmin : x;
+        x = x > xmax ? xmax : x;
+
+        // x = k ln2 + r
+        v4d kd = x * log2e + shifter;
+        v4l kbits = (v4l) kd;
+        kd -= shifter;
+        v4d r = x - kd * ln2hi - kd * ln2lo;
+
+        // Taylor series, plenty for |r| < ln2/2
+        const v4d c13 = NURFANA_V4D(1./6227020800), c12 = NURFANA_V4D(1./479001600), c11 = NURFANA_V4D(1./39916800);
+        const v4d c10 = NURFANA_V4D(1./3628800), c9 = NURFANA_V4D(1./362880), c8 = NURFANA_V4D(1./40320);
+        const v4d c7 = NURFANA_V4D(1./5040), c6 = NURFANA_V4D(1./720), c5 = NURFANA_V4D(1./120);
+        const v4d c4 = NURFANA_V4D(1./24), c3 = NURFANA_V4D(1./6), c2 = NURFANA_V4D(0.5), c1 = NURFANA_V4D(1.);
+        v4d p = ((((((((((((c13 * r + c12) * r + c11) * r + c10) * r + c9) * r + c8) * r + c7) * r + c6) * r + c5) * r + c4) * r + c3) * r + c2) * r + c1) * r + c1;
+
+        // 2^k, built directly in the exponent bits
+        v4l sbits = (kbits + bias) << mantissa_bits;
+        v4d v = va + vb * (p * (v4d) sbits);
+
+        if (n == 4) memcpy(out + i, &v, sizeof(v));
+        else
+        {
+          memcpy(buf, &v, sizeof(v));
+          for (size_t j = 0; j < n; j++) out[i+j] = buf[j];
+        }
+      }
+#endif
+    }
+
+
+    /** *da = a.y and *db = b.y, for n a multiple of 4. Two at once since they share the loads from y. */
+    inline void dot2(size_t n, const double * a, const double * b, const double * y, double * da, double * db)
+    {
+#ifdef __AVX__
+      v4d sa = NURFANA_V4D(0.);
+      v4d sb = NURFANA_V4D(0.);
+      for (size_t i = 0; i < n; i += 4)
+      {
+        v4d va, vb, vy;
+        memcpy(&va, a + i, sizeof(va));
+        memcpy(&vb, b + i, sizeof(vb));
+        memcpy(&vy, y + i, sizeof(vy));
+        sa += va * vy;
+        sb += vb * vy;
+      }
+      *da = (sa[0] + sa[1]) + (sa[2] + sa[3]);
+      *db = (sb[0] + sb[1]) + (sb[2] + sb[3]);
+#else
+      double sa[4] = { 0, 0, 0, 0 };
+      double sb[4] = { 0, 0, 0, 0 };
+      for (size_t i = 0; i < n; i += 4)
+      {
+        for (int j = 0; j < 4; j++)
+        {
+          sa[j] += a[i+j] * y[i+j];
+          sb[j] += b[i+j] * y[i+j];
+        }
+      }
+      *da = (sa[0] + sa[1]) + (sa[2] + sa[3]);
+      *db = (sb[0] + sb[1]) + (sb[2] + sb[3]);
+#endif
+    }
+
+#undef NURFANA_V4D
+
+
+    /** Summary statistics of an array, see stats() */
+    struct stats_t
+    {
+      double max;  // largest value (or absolute value), but at least 0
+      size_t imax; // index of its first occurrence, 0 if nothing is above 0
+      double sum;
+      double sum2;
+    };
+
+    /* Vector widths for stats_kernel. The vector types are members rather than template arguments, since GCC drops their attributes otherwise. */
+    struct width4_t
+    {
+      typedef double vd __attribute__((vector_size(32)));
+      typedef int64_t vl __attribute__((vector_size(32)));
+      enum { W = 4 };
+    };
+
+    struct width8_t
+    {
+      typedef double vd __attribute__((vector_size(64)));
+      typedef int64_t vl __attribute__((vector_size(64)));
+      enum { W = 8 };
+    };
+
+    /* One pass over y, two vectors at a time to hide the add latency.
+     * This is always inlined into a function with the right target attribute for the width. */
+    template <typename T>
+    inline __attribute__((always_inline)) void stats_kernel(size_t N, const double * y, bool use_abs, stats_t * st)
+    {
+      typedef typename T::vd vd;
+      typedef typename T::vl vl;
+      const int W = T::W;
+
+      vd max0 = {}, max1 = {};
+      vd imax0 = {}, imax1 = {};
+      vd sum0 = {}, sum1 = {};
+      vd sum20 = {}, sum21 = {};
+      vd idx0, idx1, step;
+      vl mask;
+      for (int j = 0; j < W; j++)
+      {
+        idx0[j] = j;
+        idx1[j] = W + j;
+        step[j] = 2*W;
+        mask[j] = use_abs ? 0x7fffffffffffffffll : -1; // clears the sign bit for the absolute value
+      }
+
+      size_t i = 0;
+      for (; i + 2*W <= N; i += 2*W)
+      {
+        vd v0, v1;
+        memcpy(&v0, y + i, sizeof(v0));
+        memcpy(&v1, y + i + W, sizeof(v1));
+        sum0 += v0;
+        sum1 += v1;
+        sum20 += v0 * v0;
+        sum21 += v1 * v1;
+
+        vd a0 = (vd) ((vl) v0 & mask);
+        vd a1 = (vd) ((vl) v1 & mask);
+        vl gt0 = a0 > max0;
+        vl gt1 = a1 > max1;
+        max0 = gt0 ? a0 : max0;
+        max1 = gt1 ? a1 : max1;
+        imax0 = gt0 ? idx0 : imax0;
+        imax1 = gt1 ? idx1 : imax1;
+        idx0 += step;
+        idx1 += step;
+      }
+
+      double max = 0;
+      size_t imax = 0;
+      double sum = 0, sum2 = 0;
+      for (int j = 0; j < W; j++)
+      {
+        sum += sum0[j] + sum1[j];
+        sum2 += sum20[j] + sum21[j];
+        // each lane has the first occurrence of its maximum, so take the earliest of the tied lanes
+        if (max0[j] > max || (max0[j] == max && max0[j] > 0 && imax0[j] < imax)) { max = max0[j]; imax = imax0[j]; }
+        if (max1[j] > max || (max1[j] == max && max1[j] > 0 && imax1[j] < imax)) { max = max1[j]; imax = imax1[j]; }
+      }
+
+      for (; i < N; i++)
+      {
+        double v = y[i];
+        sum += v;
+        sum2 += v*v;
+        double a = use_abs ? fabs(v) : v;
+        if (a > max) { max = a; imax = i; }
+      }
+
+      st->max = max;
+      st->imax = imax;
+      st->sum = sum;
+      st->sum2 = sum2;
+    }
+
+    inline void stats_generic(size_t N, const double * y, bool use_abs, stats_t * st)
+    {
+      double max = 0;
+      size_t imax = 0;
+      double sum = 0, sum2 = 0;
+      for (size_t i = 0; i < N; i++)
+      {
+        double v = y[i];
+        sum += v;
+        sum2 += v*v;
+        double a = use_abs ? fabs(v) : v;
+        if (a > max) { max = a; imax = i; }
+      }
+      st->max = max;
+      st->imax = imax;
+      st->sum = sum;
+      st->sum2 = sum2;
+    }
+
+#ifdef NURFANA_SIMD_DISPATCH
+    /** 2 with AVX-512F, 1 with AVX2, otherwise 0 */
+    inline int cpu_level()
+    {
+      static const int level = __builtin_cpu_supports("avx512f") ? 2 : __builtin_cpu_supports("avx2") ? 1 : 0;
+      return level;
+    }
+
+    __attribute__((target("avx2"))) inline void stats_avx2(size_t N, const double * y, bool use_abs, stats_t * st) { stats_kernel<width4_t>(N, y, use_abs, st); }
+    __attribute__((target("avx512f"))) inline void stats_avx512(size_t N, const double * y, bool use_abs, stats_t * st) { stats_kernel<width8_t>(N, y, use_abs, st); }
+#endif
+
+    /** Peak, sum and sum of squares of y[0..N) in one pass, using the widest vectors the CPU running this has.
+     * If use_abs, the peak is of |y|. The sums may differ from a sequential loop in the last bits. */
+    inline void stats(size_t N, const double * y, bool use_abs, stats_t * st)
+    {
+#ifdef NURFANA_SIMD_DISPATCH
+      switch (cpu_level())
+      {
+        case 2: stats_avx512(N, y, use_abs, st); return;
+        case 1: stats_avx2(N, y, use_abs, st); return;
+        default: break;
+      }
+#endif
+      stats_generic(N, y, use_abs, st);
+    }
+
+
+    inline void magnitude_generic(size_t N, const double * x, const double * y, double * out)
+    {
+      for (size_t i = 0; i < N; i++) out[i] = sqrt(x[i]*x[i] + y[i]*y[i]);
+    }
+
+#ifdef NURFANA_SIMD_DISPATCH
+    __attribute__((target("avx2"))) inline void magnitude_avx2(size_t N, const double * x, const double * y, double * out)
+    {
+      size_t i = 0;
+      for (; i + 4 <= N; i += 4)
+      {
+        __m256d a = _mm256_loadu_pd(x + i);
+        __m256d b = _mm256_loadu_pd(y + i);
+        _mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(a,a), _mm256_mul_pd(b,b))));
+      }
+      magnitude_generic(N - i, x + i, y + i, out + i);
+    }
+
+    __attribute__((target("avx512f"))) inline void magnitude_avx512(size_t N, const double * x, const double * y, double * out)
+    {
+      size_t i = 0;
+      for (; i + 8 <= N; i += 8)
+      {
+        __m512d a = _mm512_loadu_pd(x + i);
+        __m512d b = _mm512_loadu_pd(y + i);
+        // the zero-masked form, since _mm512_sqrt_pd trips -Wmaybe-uninitialized in some gcc versions
+        _mm512_storeu_pd(out + i, _mm512_maskz_sqrt_pd((__mmask8) 0xff, _mm512_add_pd(_mm512_mul_pd(a,a), _mm512_mul_pd(b,b))));
+      }
+      magnitude_generic(N - i, x + i, y + i, out + i);
+    }
+#endif
+
+    /** out[i] = sqrt(x[i]^2 + y[i]^2), e.g. for the envelope from the two parts of an analytic signal. out may alias x or y.
+     * libm's sqrt sets errno, which keeps the compiler from vectorizing the plain loop, so this is dispatched like stats().
+     * Where the target has FMA, the result may differ from the plain loop in the last bit. */
+    inline void magnitude(size_t N, const double * x, const double * y, double * out)
+    {
+#ifdef NURFANA_SIMD_DISPATCH
+      switch (cpu_level())
+      {
+        case 2: magnitude_avx512(N, x, y, out); return;
+        case 1: magnitude_avx2(N, x, y, out); return;
+        default: break;
+      }
+#endif
+      magnitude_generic(N, x, y, out);
+    }
+
+
+    /* The kernels for cmul (and, if accumulate, cmac) */
+    inline void cmul_generic(size_t n, const double * a, const double * b, double * out, bool accumulate)
+    {
+      for (size_t i = 0; i < 2*n; i += 2)
+      {
+        double re = a[i] * b[i] - a[i+1] * b[i+1];
+        double im = a[i] * b[i+1] + a[i+1] * b[i];
+        out[i] = accumulate ? out[i] + re : re;
+        out[i+1] = accumulate ? out[i+1] + im : im;
+      }
+    }
+
+#ifdef NURFANA_SIMD_DISPATCH
+    __attribute__((target("avx2"))) inline void cmul_avx2(size_t n, const double * a, const double * b, double * out, bool accumulate)
+    {
+      size_t i = 0;
+      for (; i + 2 <= n; i += 2)
+      {
+        __m256d va = _mm256_loadu_pd(a + 2*i);
+        __m256d vb = _mm256_loadu_pd(b + 2*i);
+        __m256d br = _mm256_movedup_pd(vb);        // re b, re b
+        __m256d bi = _mm256_permute_pd(vb, 0xf);   // im b, im b
+        __m256d as = _mm256_permute_pd(va, 0x5);   // im a, re a
+        __m256d r = _mm256_addsub_pd(_mm256_mul_pd(va, br), _mm256_mul_pd(as, bi));
+        if (accumulate) r = _mm256_add_pd(r, _mm256_loadu_pd(out + 2*i));
+        _mm256_storeu_pd(out + 2*i, r);
+      }
+      cmul_generic(n - i, a + 2*i, b + 2*i, out + 2*i, accumulate);
+    }
+
+    __attribute__((target("avx512f"))) inline void cmul_avx512(size_t n, const double * a, const double * b, double * out, bool accumulate)
+    {
+      const __mmask8 all = 0xff; // zero-masked, as in magnitude_avx512
+      size_t i = 0;
+      for (; i + 4 <= n; i += 4)
+      {
+        __m512d va = _mm512_loadu_pd(a + 2*i);
+        __m512d vb = _mm512_loadu_pd(b + 2*i);
+        __m512d br = _mm512_maskz_movedup_pd(all, vb);
+        __m512d bi = _mm512_maskz_permute_pd(all, vb, 0xff);
+        __m512d as = _mm512_maskz_permute_pd(all, va, 0x55);
+        __m512d r = _mm512_fmaddsub_pd(va, br, _mm512_mul_pd(as, bi));
+        if (accumulate) r = _mm512_add_pd(r, _mm512_loadu_pd(out + 2*i));
+        _mm512_storeu_pd(out + 2*i, r);
+      }
+      cmul_generic(n - i, a + 2*i, b + 2*i, out + 2*i, accumulate);
+    }
+#endif
+
+    /** Elementwise product of n complex numbers, stored interleaved (as std::complex<double> is): out[i] = a[i] * b[i].
+     * out may alias a or b. Unlike std::complex's operator*, this doesn't go out of its way for infinities and NaNs,
+     * which is what keeps the compiler from vectorizing that. Where the target has FMA, the result may differ in the last bit. */
+    inline void cmul(size_t n, const double * a, const double * b, double * out, bool accumulate = false)
+    {
+#ifdef NURFANA_SIMD_DISPATCH
+      switch (cpu_level())
+      {
+        case 2: cmul_avx512(n, a, b, out, accumulate); return;
+        case 1: cmul_avx2(n, a, b, out, accumulate); return;
+        default: break;
+      }
+#endif
+      cmul_generic(n, a, b, out, accumulate);
+    }
+
+    /** out[i] += a[i] * b[i], as cmul. out may not alias a or b. */
+    inline void cmac(size_t n, const double * a, const double * b, double * out) { cmul(n, a, b, out, true); }
+
+
+    /** w[k] = exp(i dphi k) for k in [0,n), stored interleaved. tmp needs room for 2 * ceil(sqrt(n)) doubles.
+     *
+     * Each is the product of an entry of a coarse and a fine table (steps of sqrt(n) and of 1). Every 8th table
+     * entry comes from sincos and the ones in between are stepped from it, so the error stays within a few ulp
+     * without needing more than about sqrt(n)/4 sincos calls. */
+    inline void phase_ramp(size_t n, double dphi, double * w, double * tmp)
+    {
+      size_t B = (size_t) ceil(sqrt((double) n));
+      double * fine = tmp;
+      double sr = cos(dphi), si = sin(dphi);
+      for (size_t j = 0; j < B; j++)
+      {
+        if (j % 8 == 0)
+        {
+          fine[2*j] = cos(dphi * j);
+          fine[2*j+1] = sin(dphi * j);
+        }
+        else
+        {
+          fine[2*j] = fine[2*j-2] * sr - fine[2*j-1] * si;
+          fine[2*j+1] = fine[2*j-2] * si + fine[2*j-1] * sr;
+        }
+      }
+
+      double cr = 1, ci = 0;
+      double Br = cos(dphi * B), Bi = sin(dphi * B);
+      for (size_t m = 0, k0 = 0; k0 < n; m++, k0 += B)
+      {
+        if (m % 8 == 0)
+        {
+          cr = cos(dphi * k0);
+          ci = sin(dphi * k0);
+        }
+        else
+        {
+          double r = cr * Br - ci * Bi;
+          ci = cr * Bi + ci * Br;
+          cr = r;
+        }
+
+        size_t len = n - k0 < B ? n - k0 : B;
+        double * wk = w + 2*k0;
+        for (size_t j = 0; j < len; j++)
+        {
+          wk[2*j] = cr * fine[2*j] - ci * fine[2*j+1];
+          wk[2*j+1] = cr * fine[2*j+1] + ci * fine[2*j];
+        }
+      }
+    }
+
+
+    /* out[i] for i in [i0,N) as in lerp(). Branch-free, so it vectorizes where the target has gathers. */
+    inline void lerp_generic(size_t i0, size_t N, const double * y, size_t n, double x0, double r, double * out)
+    {
+      const double xmax = n - 1;
+      const double kmax = n - 2;
+      for (size_t i = i0; i < N; i++)
+      {
+        double x = x0 + i * r;
+        x = !(x > 0) ? 0 : x < xmax ? x : xmax;
+        double kd = floor(x);
+        kd = kd < kmax ? kd : kmax;
+        size_t k = (size_t) kd;
+        double f = x - kd;
+        out[i] = y[k] + f * (y[k+1] - y[k]);
+      }
+    }
+
+#ifdef NURFANA_SIMD_DISPATCH
+    __attribute__((target("avx2"))) inline void lerp_avx2(size_t N, const double * y, size_t n, double x0, double r, double * out)
+    {
+      const __m256d vx0 = _mm256_set1_pd(x0);
+      const __m256d vr = _mm256_set1_pd(r);
+      const __m256d zero = _mm256_setzero_pd();
+      const __m256d xmax = _mm256_set1_pd(n - 1);
+      const __m256d kmax = _mm256_set1_pd(n - 2);
+      const __m256d step = _mm256_set1_pd(4);
+      const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1)); // the masked gather, since the plain one trips -Wmaybe-uninitialized too
+      __m256d vi = _mm256_set_pd(3, 2, 1, 0);
+      size_t i = 0;
+      for (; i + 4 <= N; i += 4)
+      {
+        // max and min return their second argument for NaN, as the ternaries in lerp_generic do
+        __m256d x = _mm256_add_pd(vx0, _mm256_mul_pd(vi, vr));
+        x = _mm256_min_pd(_mm256_max_pd(x, zero), xmax);
+        __m256d kd = _mm256_min_pd(_mm256_floor_pd(x), kmax);
+        __m128i k = _mm256_cvttpd_epi32(kd);
+        __m256d f = _mm256_sub_pd(x, kd);
+        __m256d y0 = _mm256_mask_i32gather_pd(zero, y, k, all, 8);
+        __m256d y1 = _mm256_mask_i32gather_pd(zero, y + 1, k, all, 8);
+        _mm256_storeu_pd(out + i, _mm256_add_pd(y0, _mm256_mul_pd(f, _mm256_sub_pd(y1, y0))));
+        vi = _mm256_add_pd(vi, step);
+      }
+      lerp_generic(i, N, y, n, x0, r, out);
+    }
+
+    __attribute__((target("avx512f"))) inline void lerp_avx512(size_t N, const double * y, size_t n, double x0, double r, double * out)
+    {
+      const __m512d vx0 = _mm512_set1_pd(x0);
+      const __m512d vr = _mm512_set1_pd(r);
+      const __m512d zero = _mm512_setzero_pd();
+      const __m512d xmax = _mm512_set1_pd(n - 1);
+      const __m512d kmax = _mm512_set1_pd(n - 2);
+      const __m512d step = _mm512_set1_pd(8);
+      const __mmask8 all = 0xff; // zero-masked forms throughout, as in magnitude_avx512
+      __m512d vi = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+      size_t i = 0;
+      for (; i + 8 <= N; i += 8)
+      {
+        __m512d x = _mm512_add_pd(vx0, _mm512_mul_pd(vi, vr));
+        x = _mm512_maskz_min_pd(all, _mm512_maskz_max_pd(all, x, zero), xmax);
+        __m512d kd = _mm512_maskz_min_pd(all, _mm512_maskz_roundscale_pd(all, x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC), kmax);
+        __m256i k = _mm512_maskz_cvttpd_epi32(all, kd);
+        __m512d f = _mm512_sub_pd(x, kd);
+        __m512d y0 = _mm512_mask_i32gather_pd(zero, all, k, y, 8);
+        __m512d y1 = _mm512_mask_i32gather_pd(zero, all, k, y + 1, 8);
+        _mm512_storeu_pd(out + i, _mm512_add_pd(y0, _mm512_mul_pd(f, _mm512_sub_pd(y1, y0))));
+        vi = _mm512_add_pd(vi, step);
+      }
+      lerp_generic(i, N, y, n, x0, r, out);
+    }
+#endif
+
+    /** Linear interpolation of y[0..n), n >= 2, at the N evenly spaced (fractional) indices x0 + i * r, clamped to [0, n-1].
+     * When r is 1 (the same sampling, shifted) the samples used are contiguous, and the interior is a plain vectorizable loop.
+     * Otherwise, each output works out its own index, so there is no search and no branching, and the loads are gathers. */
+    inline void lerp(size_t N, const double * y, size_t n, double x0, double r, double * out)
+    {
+      if (r == 1 && fabs(x0) < n + N)
+      {
+        // k = floor(x0) + i is in [0, n-2] for i in [i0, i1)
+        double k0 = floor(x0);
+        double f = x0 - k0;
+        size_t i0 = k0 < 0 ? (size_t) -k0 : 0;
+        size_t i1 = k0 + N <= n - 1 ? N : k0 < n - 1 ? (size_t) (n - 1 - k0) : 0;
+        if (i0 > i1) i0 = i1;
+        lerp_generic(0, i0, y, n, x0, r, out);
+        const double * yk = y + (ptrdiff_t) k0;
+        for (size_t i = i0; i < i1; i++) out[i] = yk[i] + f * (yk[i+1] - yk[i]);
+        lerp_generic(i1, N, y, n, x0, r, out);
+        return;
+      }
+
+#ifdef NURFANA_SIMD_DISPATCH
+      if (n <= 0x7fffffff) // the gathers take 32-bit indices
+      {
+        switch (cpu_level())
+        {
+          case 2: lerp_avx512(N, y, n, x0, r, out); return;
+          case 1: lerp_avx2(N, y, n, x0, r, out); return;
+          default: break;
+        }
+      }
+#endif
+      lerp_generic(0, N, y, n, x0, r, out);
+    }
+  }
+}
+
+#endif